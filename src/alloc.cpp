@@ -0,0 +1,48 @@
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+#include "alloc.hpp"
+
+#ifdef COUNT_ALLOCS
+
+namespace {
+    std::atomic<unsigned long> count(0);
+}
+
+void* operator new(std::size_t size) {
+    count++;
+    auto res = std::malloc(size == 0 ? 1 : size);
+    if (res == nullptr) {
+        throw std::bad_alloc();
+    }
+    return res;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+bool alloc::is_counting() {
+    return true;
+}
+
+unsigned long alloc::get_count() {
+    return count;
+}
+
+#else
+
+bool alloc::is_counting() {
+    return false;
+}
+
+unsigned long alloc::get_count() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+namespace alloc {
+    // allocations made through operator new so far, they are only counted
+    // in builds with COUNT_ALLOCS defined, the count is the one of the whole
+    // process and includes the allocations of every console in it
+    bool is_counting();
+    unsigned long get_count();
+}
@@ -0,0 +1,87 @@
+#include "console.hpp"
+
+t_console::t_console() :
+    input(display),
+    machine(ppu, input),
+    ppu(machine, display) {
+}
+
+// a headless console runs without a window, set before init
+void t_console::set_headless(bool val) {
+    display.set_headless(val);
+}
+
+int t_console::init() {
+    machine.init();
+    return ppu.init();
+}
+
+int t_console::load_program(const std::string& file) {
+    return machine.load_program(file);
+}
+
+void t_console::set_jit(bool enabled, bool verify) {
+    machine.set_jit(enabled, verify);
+}
+
+// the display presents the frames of the ppu thread from the thread
+// running the console
+void t_console::set_ppu_thread(bool enabled) {
+    display.set_deferred(enabled);
+    machine.set_ppu_thread(enabled);
+}
+
+void t_console::set_render_threads(unsigned threads) {
+    ppu.set_render_threads(threads);
+}
+
+void t_console::set_frames_per_second(unsigned val) {
+    ppu.set_frames_per_second(val);
+}
+
+void t_console::set_frame_skip(unsigned frames, bool automatic) {
+    ppu.set_frame_skip(frames, automatic);
+}
+
+bool t_console::is_running() {
+    return ppu.is_running();
+}
+
+bool t_console::should_poll() {
+    return ppu.should_poll();
+}
+
+void t_console::poll() {
+    ppu.poll();
+}
+
+// runs up to the end of the cpu cycle in which the ppu presents the next
+// frame, so the display is polled at the same point as when the ppu and the
+// cpu are stepped cycle by cycle
+void t_console::run() {
+    machine.run_cycles((ppu.get_dots_until_render() + 2) / 3);
+    display.present();
+}
+
+void t_console::run_cycles(unsigned long cycles) {
+    machine.run_cycles(cycles);
+    display.present();
+}
+
+void t_console::run_frame() {
+    machine.run_frame();
+    display.present();
+}
+
+void t_console::close() {
+    machine.set_ppu_thread(false);
+    ppu.close();
+}
+
+t_machine& t_console::get_machine() {
+    return machine;
+}
+
+t_ppu& t_console::get_ppu() {
+    return ppu;
+}
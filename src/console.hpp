@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include "machine.hpp"
+#include "gfx.hpp"
+#include "input.hpp"
+#include "sdl.hpp"
+
+// one emulated console, owns all of its components and wires them together,
+// several consoles can live in one process, headless ones need no sdl and
+// the ones with a window a t_sdl_session
+class t_console {
+public:
+    t_console();
+    t_console(const t_console&) = delete;
+    t_console& operator=(const t_console&) = delete;
+
+    void set_headless(bool);
+    int init();
+    int load_program(const std::string&);
+    void set_jit(bool, bool = false);
+    void set_ppu_thread(bool);
+    void set_render_threads(unsigned);
+    void set_frames_per_second(unsigned);
+    void set_frame_skip(unsigned, bool = false);
+    bool is_running();
+    bool should_poll();
+    void poll();
+    void run();
+    void run_cycles(unsigned long);
+    void run_frame();
+    void close();
+
+    t_machine& get_machine();
+    t_ppu& get_ppu();
+
+private:
+    t_display display;
+    t_input input;
+    t_machine machine;
+    t_ppu ppu;
+};
@@ -7,11 +7,11 @@
 #include <cstdlib>
 
 #include "misc.hpp"
+#include "logger.hpp"
 #include "gfx.hpp"
 #include "machine.hpp"
 #include "sdl.hpp"
 
-const auto transparent_pixel = char(0xff);
 const auto scanline_length = 341u;
 const auto scanline_count = 262u;
 const auto prerender_line = scanline_count - 1;
@@ -23,573 +23,768 @@ const auto spr_x_ofs = 3;
 const auto spr_atr_flip_hor_bit = 6;
 const auto spr_atr_flip_ver_bit = 7;
 
-namespace {
-    char read_mem(unsigned);
-    char get_palette_entry(unsigned);
-    char get_palette_attribute(unsigned);
-    char spr_pat_get(unsigned, unsigned, unsigned);
+const auto no_row = ~0u;
+const auto no_hit = ~0u;
+
+void t_ppu::print_tile(unsigned idx) {
+    for (auto i = 0u; i < 8; i++) {
+        for (auto j = 0u; j < 8; j++) {
+            auto m0 = spr_pat_get(idx, i, 0);
+            auto m1 = spr_pat_get(idx, i, 1);
+            auto mm = get_bit(m1, 7 - j) * 2u + get_bit(m0, 7 - j);
+            if (mm == 0) {
+                logger::write(logger::level_trace, logger::cat_ppu_sprite,
+                        " ");
+            } else {
+                logger::write(logger::level_trace, logger::cat_ppu_sprite,
+                        "%u", mm);
+            }
+        }
+        logger::write(logger::level_trace, logger::cat_ppu_sprite,
+                "\n");
+    }
 }
 
-namespace {
-    FILE* log;
-
-    void print_tile(unsigned idx) {
-        for (auto i = 0u; i < 8; i++) {
-            for (auto j = 0u; j < 8; j++) {
-                auto m0 = spr_pat_get(idx, i, 0);
-                auto m1 = spr_pat_get(idx, i, 1);
-                auto mm = get_bit(m1, 7 - j) * 2u + get_bit(m0, 7 - j);
-                if (mm == 0) {
-                    debug_print(log, " ");
-                } else {
-                    debug_print(log, "%u", mm);
-                }
-            }
-            debug_print(log, "\n");
+void t_ppu::decode_tile(unsigned idx) {
+    auto rows = &tile_cache[idx * 2 * 8 * 8];
+    for (auto y = 0u; y < 8; y++) {
+        auto lo = pattern_table[16 * idx + y];
+        auto hi = pattern_table[16 * idx + y + 8];
+        for (auto x = 0u; x < 8; x++) {
+            auto pixel = get_bit(lo, 7 - x) + 2 * get_bit(hi, 7 - x);
+            rows[8 * y + x] = pixel;
+            rows[8 * 8 + 8 * y + 7 - x] = pixel;
         }
     }
+    tile_cached[idx] = true;
+}
 
-    bool sprite_0_hit_delayed;
-    bool sprite_0_hit;
-    bool sprite_0_y_in_range;
-    bool sprite_0_y_in_range_next;
+// the pixels of the row whose low plane is at the given pattern table
+// address, the cache is filled on first use and after writes to the tile
+const char* t_ppu::get_tile_row(unsigned adr, bool flip) {
+    auto idx = adr / 16;
+    if (not tile_cached[idx]) {
+        decode_tile(idx);
+    }
+    return &tile_cache[(2 * idx + flip) * 8 * 8 + 8 * (adr % 16)];
+}
 
-    unsigned copy_cnt;
-    std::array<char, 64 * 4> oam;
-    std::array<char, 8 * 4> sec_oam;
+char t_ppu::read_sec_oam(unsigned i, unsigned j) {
+    return sec_oam[4 * i + j];
+}
 
-    char read_sec_oam(unsigned i, unsigned j) {
-        return sec_oam[4 * i + j];
-    }
+void t_ppu::set_v(unsigned x) {
+    // logger::write(logger::level_trace, logger::cat_ppu_reg,
+    //         "(%03u, %03u) v :  %03x %02x %05x %05x\n",
+    //         hor_cnt, ver_cnt,
+    //         get_bits(x, 12, 3), get_bits(x, 10, 2),
+    //         get_bits(x, 5, 5), get_bits(x, 0, 5));
+    logger::write(logger::level_trace, logger::cat_ppu_reg,
+            "(%03u, %03u) v = $%04x\n", hor_cnt, ver_cnt, x);
+    cur_adr = x;
+}
 
-    std::array<char, 8> spr_bitmap_lo;
-    std::array<char, 8> spr_bitmap_hi;
-    std::array<char, 8> spr_atr;
-    std::array<char, 8> spr_x;
-    std::array<bool, 8> spr_active;
-    unsigned oam_idx;
-    unsigned sec_oam_idx;
-    char oam_data;
-    char tmp_spr_y;
-    char tmp_spr_idx;
+unsigned t_ppu::get_v() {
+    return cur_adr;
+}
 
-    bool started;
+unsigned t_ppu::canonize_adr(unsigned adr) {
+    return get_bits(adr, 0, 14);
+}
 
-    bool in_vblank;
-    unsigned long frame_idx;
+unsigned t_ppu::get_sprite_priority(unsigned i) {
+     return get_bit(spr_atr[i], 5);
+}
 
-    unsigned hor_cnt;
-    unsigned ver_cnt;
+void t_ppu::load_tile_data() {
+    set_octet(bg_bits[0], 0, tile_bitmap_low);
+    set_octet(bg_bits[1], 0, tile_bitmap_high);
+    set_octet(bg_bits[2], 0, get_bit(at_bits, 0) ? 0xff : 0x00);
+    set_octet(bg_bits[3], 0, get_bit(at_bits, 1) ? 0xff : 0x00);
+}
 
-    unsigned set_adr;
-    char set_val;
-    unsigned long set_delay;
-    bool set_delay_active;
+void t_ppu::shift_tile_data() {
+    for (auto& x : bg_bits) {
+        x <<= 1;
+    }
+}
 
-    char oam_adr;
-    char control_reg;
-    char data_read_buffer;
+char t_ppu::fetch_bg_pal_idx(unsigned fxs) {
+    auto res = 0u;
+    for (auto i = 0u; i < 4; i++) {
+        set_bit(res, i, get_bit(bg_bits[i], 15 - fxs));
+    }
+    return res;
+}
 
-    std::array<char, 0x0800> memory;
-    std::array<char, 0x2000> pattern_table;
-    std::array<char, 0x20> palette;
+bool t_ppu::get_nmi_output_flag() {
+    return get_bit(control_reg, 7);
+}
 
-    unsigned cur_adr;
+void t_ppu::gen_vblank_nmi() {
+    if (in_vblank and get_nmi_output_flag()) {
+        machine.set_nmi_flag();
+    }
+}
 
-    void set_v(unsigned x) {
-        // debug_print(log, "(%03u, %03u) v :  %03x %02x %05x %05x\n",
-        //         hor_cnt, ver_cnt,
-        //         get_bits(x, 12, 3), get_bits(x, 10, 2),
-        //         get_bits(x, 5, 5), get_bits(x, 0, 5));
-        debug_print(log, "(%03u, %03u) v = $%04x\n", hor_cnt, ver_cnt, x);
-        cur_adr = x;
+// the palette entries of the backdrop, 0x3f10, 0x3f14, 0x3f18 and 0x3f1c,
+// are shared with the ones 0x10 below
+unsigned t_ppu::get_palette_index(unsigned adr) {
+    auto idx = get_last_bits(adr, 5);
+    if (get_last_bits(idx, 2) == 0) {
+        idx = get_last_bits(idx, 4);
     }
+    return idx;
+}
 
-    unsigned get_v() {
-        return cur_adr;
+void t_ppu::write_mem(unsigned adr, char val) {
+    adr = canonize_adr(adr);
+    if (adr >= 0x3f00u) {
+        auto idx = get_palette_index(adr);
+        palette[idx] = val;
+        palette_pixels[idx] = display.get_pixel(val);
+        if (get_last_bits(idx, 2) == 0) {
+            palette[idx + 0x10] = val;
+            palette_pixels[idx + 0x10] = palette_pixels[idx];
+        }
+        return;
+    }
+    vram_pages[adr / vram_page_size][adr % vram_page_size] = val;
+    if (adr < 0x2000u) {
+        tile_cached[adr / 16] = false;
+    } else if (adr % vram_page_size >= 0x3c0u) {
+        update_attribute_map(adr, val);
     }
+}
 
-    unsigned tmp_adr;
-    unsigned fine_x_scroll;
-    bool write_toggle;
+char t_ppu::read_mem(unsigned adr) {
+    adr = canonize_adr(adr);
+    if (adr >= 0x3f00u) {
+        return palette[get_palette_index(adr)];
+    }
+    return vram_pages[adr / vram_page_size][adr % vram_page_size];
+}
 
-    bool mirroring;
+char t_ppu::get_palette_entry(unsigned idx) {
+    return read_mem(0x3f00u + idx);
+}
 
-    char nt_byte;
-    char at_byte;
-    char tile_bitmap_low;
-    char tile_bitmap_high;
+char t_ppu::get_bg_pattern_table_entry(unsigned idx) {
+    if (get_bit(control_reg, 4)) {
+        return read_mem(0x1000u + idx);
+    } else {
+        return read_mem(idx);
+    }
+}
 
-    unsigned canonize_adr(unsigned adr) {
-        return get_bits(adr, 0, 14);
+char t_ppu::get_bg_pattern_table_entry(unsigned a, unsigned y, unsigned i) {
+    a = 16 * a + y;
+    if (i == 1) {
+        a += 8;
     }
+    auto res = get_bg_pattern_table_entry(a);
+    return res;
+}
 
-    std::array<unsigned, 4> bg_bits;
+char t_ppu::spr_pat_get(unsigned idx) {
+    if (get_bit(control_reg, 3)) {
+        return read_mem(0x1000u + idx);
+    } else {
+        return read_mem(idx);
+    }
+}
 
-    bool show_background;
-    bool show_sprites;
+char t_ppu::spr_pat_get(unsigned a, unsigned y, unsigned i) {
+    return spr_pat_get(16 * a + y + 8 * i);
+}
 
-    unsigned get_sprite_priority(unsigned i) {
-         return get_bit(spr_atr[i], 5);
-    }
+unsigned t_ppu::get_tile_address(unsigned adr) {
+    unsigned res = 0;
+    copy_bits(res, 0, 12, adr);
+    set_bit(res, 13);
+    return res;
+}
+
+unsigned t_ppu::get_fine_y_scroll() {
+    return get_bits(get_v(), 12, 3);
+}
 
-    void load_tile_data() {
-        set_octet(bg_bits[0], 0, tile_bitmap_low);
-        set_octet(bg_bits[1], 0, tile_bitmap_high);
-        set_octet(bg_bits[2], 0, get_palette_attribute(0));
-        set_octet(bg_bits[3], 0, get_palette_attribute(1));
+void t_ppu::set_fine_y_scroll(unsigned x) {
+    auto y = get_v();
+    copy_bits(y, 12, 3, x);
+    set_v(y);
+}
+
+unsigned t_ppu::get_coarse_y_scroll() {
+    return get_bits(get_v(), 5, 5);
+}
+
+unsigned t_ppu::get_coarse_x_scroll() {
+    return get_bits(get_v(), 0, 5);
+}
+
+void t_ppu::set_coarse_y_scroll(unsigned x) {
+    auto y = get_v();
+    copy_bits(y, 5, 5, x);
+    set_v(y);
+}
+
+void t_ppu::fetch_nametable_byte() {
+    nt_byte = read_mem(get_tile_address(get_v()));
+    logger::write(logger::level_trace, logger::cat_ppu_fetch,
+            "fetch nt byte %02hhx\n", nt_byte);
+}
+
+// the attribute map already holds the 2 bits of the attribute byte that
+// belong to the quadrant of the tile
+void t_ppu::fetch_attribute_table_byte() {
+    auto v = get_v();
+    at_bits = attribute_map[nametable_pages[get_bits(v, 10, 2)]
+        * attribute_map_size + get_bits(v, 0, 10)];
+    logger::write(logger::level_trace, logger::cat_ppu_fetch,
+            "fetchl at bits %u\n", unsigned(at_bits));
+}
+
+void t_ppu::fetch_tile_bitmap_low() {
+    auto fy = get_fine_y_scroll();
+    tile_bitmap_low = get_bg_pattern_table_entry(nt_byte, fy, 0);
+    logger::write(logger::level_trace, logger::cat_ppu_fetch,
+            "fetch tile bitmap low %02hhx\n", tile_bitmap_low);
+}
+
+void t_ppu::fetch_tile_bitmap_high() {
+    auto fy = get_fine_y_scroll();
+    tile_bitmap_high = get_bg_pattern_table_entry(nt_byte, fy, 1);
+    logger::write(logger::level_trace, logger::cat_ppu_fetch,
+            "fetch tile bitmap high %02hhx\n", tile_bitmap_high);
+}
+
+void t_ppu::inc_hor_scroll() {
+    auto v = get_v();
+    if (get_bits(v, 0, 5) == 0x1fu) {
+        set_bits(v, 0, 5, 0);
+        flip_bit(v, 10);
+    } else {
+        v++;
     }
+    set_v(v);
+}
 
-    void shift_tile_data() {
-        for (auto& x : bg_bits) {
-            x <<= 1;
+void t_ppu::inc_ver_scroll() {
+    auto fine_y = get_fine_y_scroll();
+    if (fine_y < 7) {
+        set_fine_y_scroll(fine_y + 1);
+    } else {
+        set_fine_y_scroll(0);
+        auto y = get_coarse_y_scroll();
+        if (y == 29) {
+            y = 0;
+            auto v = get_v();
+            flip_bit(v, 11);
+            set_v(v);
+        } else if (y == 31) {
+            y = 0;
+        } else {
+            y++;
         }
+        set_coarse_y_scroll(y);
     }
+}
+
+void t_ppu::reset_hor_scroll() {
+    auto v = get_v();
+    copy_bits(v, 0, 5, tmp_adr, 0);
+    set_bit(v, 10, get_bit(tmp_adr, 10));
+    set_v(v);
+}
+
+void t_ppu::reset_ver_scroll() {
+    auto v = get_v();
+    copy_bits(v, 5, 5, tmp_adr, 5);
+    copy_bits(v, 11, 4, tmp_adr, 11);
+    set_v(v);
+}
 
-    char fetch_bg_pal_idx(unsigned fxs) {
-        auto res = 0u;
-        for (auto i = 0u; i < 4; i++) {
-            set_bit(res, i, get_bit(bg_bits[i], 15 - fxs));
+// spreads the 4 quadrants of an attribute byte over the 4 by 4 tiles it
+// covers in the attribute map of its nametable
+void t_ppu::update_attribute_map(unsigned adr, char val) {
+    auto map = &attribute_map[nametable_pages[get_bits(adr, 10, 2)]
+        * attribute_map_size];
+    auto x = get_bits(adr, 0, 3) * 4;
+    auto y = get_bits(adr, 3, 3) * 4;
+    for (auto i = 0u; i < 4; i++) {
+        for (auto j = 0u; j < 4; j++) {
+            auto q = i / 2 * 2 + j / 2;
+            map[(y + i) * 32 + x + j] = get_bits(val, 2 * q, 2);
         }
-        return res;
     }
+}
 
-    bool get_nmi_output_flag() {
-        return get_bit(control_reg, 7);
+// pixels are composed as palette indices and only turned into the pixels of
+// the display once composed
+char t_ppu::get_bg_pixel(unsigned pal_idx) {
+    if (pal_idx % 4 == 0) {
+        return transparent_pixel;
+    } else {
+        return pal_idx;
     }
+}
 
-    void gen_vblank_nmi() {
-        if (in_vblank and get_nmi_output_flag()) {
-            machine::set_nmi_flag();
-        }
+char t_ppu::background_fetch_pixel() {
+    return get_bg_pixel(fetch_bg_pal_idx(fine_x_scroll));
+}
+
+char t_ppu::compose_pixel(char bg, char spr, unsigned spr_priority) {
+    auto pixel = bg;
+    if (pixel == transparent_pixel) {
+        pixel = spr;
+    }
+    if (spr_priority == 0 and spr != transparent_pixel) {
+        pixel = spr;
     }
+    if (pixel == transparent_pixel) {
+        pixel = 0;
+    }
+    return pixel;
+}
 
-    void write_mem(unsigned adr, char val) {
-        adr = canonize_adr(adr);
-        if (adr == 0x3f10 || adr == 0x3f14 || adr == 0x3f18 || adr == 0x3f1c) {
-            adr -= 0x10;
-        }
-        if (adr < 0x2000u) {
-            pattern_table[adr] = val;
-        } else if (adr < 0x3effu) {
-            if (adr >= 0x3000u) {
-                adr -= 0x1000u;
-            }
-            adr -= 0x2000u;
-            if (mirroring == 0) {
-                if (in_range(adr, 0x400, 0x800)) {
-                    adr -= 0x400;
-                } else if (in_range(adr, 0x800, 0xc00)) {
-                    adr -= 0x400;
-                } else if (in_range(adr, 0xc00, 0x1000)) {
-                    adr -= 0x800;
-                }
-            } else {
-                if (in_range(adr, 0x800, 0xc00)) {
-                    adr -= 0x800;
-                } else if (in_range(adr, 0xc00, 0x1000)) {
-                    adr -= 0x800;
-                }
-            }
-            memory[adr] = val;
-        } else {
-            char idx = get_last_bits(adr, 5);
-            palette[idx] = val;
-            if (get_last_bits(idx, 2) == 0) {
-                flip_bit(idx, 4);
-                palette[idx] = val;
-            }
-        }
+// brings a slot from the state it was fetched in to the one the dots since
+// then would have shifted it to, the dots count down x and shift an active
+// slot, a slot whose x reaches 0 becomes active on the next dot
+void t_ppu::advance_sprite(unsigned i) {
+    auto n = spr_clock - spr_base[i];
+    spr_base[i] = spr_clock;
+    auto x = unsigned(spr_x[i]);
+    auto shifts = 0ul;
+    if (spr_active[i]) {
+        shifts = n;
+    } else if (x > 0 and n >= x) {
+        shifts = n - x;
+        spr_active[i] = true;
     }
+    spr_x[i] = x - std::min<unsigned long>(n, x);
+    spr_bitmap_lo[i] = shifts < 8 ? spr_bitmap_lo[i] << shifts : 0;
+    spr_bitmap_hi[i] = shifts < 8 ? spr_bitmap_hi[i] << shifts : 0;
+    // the cached rows are the unshifted ones of the fetch
+    if (shifts != 0) {
+        spr_rows_fresh = false;
+    }
+    spr_line_valid = false;
+}
 
-    char read_mem(unsigned adr) {
-        canonize_adr(adr);
-        if (adr == 0x3f10 || adr == 0x3f14 || adr == 0x3f18 || adr == 0x3f1c) {
-            adr -= 0x10;
+// rasterizes the fetched slots by how far the newest one has been shifted,
+// the first slot with an opaque pixel wins, slots fetched earlier are
+// further along by the dots between the fetches
+void t_ppu::build_sprite_line() {
+    spr_line_base = *std::max_element(spr_base.begin(), spr_base.end());
+    spr_line.fill({ 0, false, false });
+    for (auto i = 8u; i-- > 0;) {
+        auto first = 0ul;
+        if (not spr_active[i]) {
+            first = spr_x[i];
+            if (first == 0) {
+                continue;
+            }
+        }
+        const char* row = nullptr;
+        if (spr_rows_fresh and spr_row_adr[i] != no_row) {
+            auto flip = get_bit(spr_atr[i], spr_atr_flip_hor_bit);
+            row = get_tile_row(spr_row_adr[i], flip);
         }
-        char res = 0;
-        if (adr < 0x2000u) {
-            res = pattern_table[adr];
-        } else if (adr < 0x3effu) {
-            if (adr >= 0x3000u) {
-                adr -= 0x1000u;
+        auto ahead = spr_line_base - spr_base[i];
+        auto pal_base = 16 + 4 * get_bits(spr_atr[i], 0, 2);
+        for (auto k = 0u; k < 8; k++) {
+            if (first + k < ahead or first + k - ahead >= spr_line.size()) {
+                continue;
             }
-            adr -= 0x2000u;
-            if (mirroring == 0) {
-                if (in_range(adr, 0x400, 0x800)) {
-                    adr -= 0x400;
-                } else if (in_range(adr, 0x800, 0xc00)) {
-                    adr -= 0x400;
-                } else if (in_range(adr, 0xc00, 0x1000)) {
-                    adr -= 0x800;
-                }
+            auto pixel = 0u;
+            if (row != nullptr) {
+                pixel = row[k];
             } else {
-                if (in_range(adr, 0x800, 0xc00)) {
-                    adr -= 0x800;
-                } else if (in_range(adr, 0xc00, 0x1000)) {
-                    adr -= 0x800;
-                }
+                pixel = get_bit(spr_bitmap_lo[i], 7 - k)
+                    + 2 * get_bit(spr_bitmap_hi[i], 7 - k);
+            }
+            if (pixel != 0) {
+                auto& x = spr_line[first + k - ahead];
+                x.pal_idx = pal_base + pixel;
+                x.front = get_sprite_priority(i) == 0;
+                x.zero = i == 0;
             }
-            res = memory[adr];
-        } else {
-            res = palette[get_last_bits(adr, 5)];
         }
-        return res;
     }
+    spr_line_valid = true;
+}
 
-    char get_palette_entry(unsigned idx) {
-        return read_mem(0x3f00u + idx);
+const t_ppu::t_spr_pixel& t_ppu::get_sprite_pixel(unsigned long ofs) {
+    static const t_spr_pixel none = { 0, false, false };
+    if (not spr_line_valid) {
+        build_sprite_line();
     }
+    auto n = spr_clock - spr_line_base + ofs;
+    return n < spr_line.size() ? spr_line[n] : none;
+}
 
-    char get_bg_pattern_table_entry(unsigned idx) {
-        if (get_bit(control_reg, 4)) {
-            return read_mem(0x1000u + idx);
-        } else {
-            return read_mem(idx);
-        }
-    }
+// the pixels of a skipped frame only matter while they can still set the
+// sprite 0 hit flag
+bool t_ppu::is_sprite_0_hit_possible() {
+    return not sprite_0_hit and sprite_0_y_in_range
+        and show_background and show_sprites;
+}
 
-    char get_bg_pattern_table_entry(unsigned a, unsigned y, unsigned i) {
-        a = 16 * a + y;
-        if (i == 1) {
-            a += 8;
-        }
-        auto res = get_bg_pattern_table_entry(a);
-        return res;
-    }
+// the opaque pixels of a pattern row as a bit mask in the order of the
+// bitmaps, a pixel is opaque when either of its two planes is set
+char t_ppu::get_row_mask(unsigned adr, bool flip) {
+    char res = pattern_table[adr] | pattern_table[adr + 8];
+    return flip ? reverse(res) : res;
+}
 
-    char spr_pat_get(unsigned idx) {
-        if (get_bit(control_reg, 3)) {
-            return read_mem(0x1000u + idx);
-        } else {
-            return read_mem(idx);
-        }
-    }
+// the opaque mask of the background row fetched with v
+char t_ppu::get_bg_row_mask(unsigned v) {
+    auto base = get_bit(control_reg, 4) ? 0x1000u : 0u;
+    auto nt = unsigned(read_mem(get_tile_address(v)));
+    return get_row_mask(base + 16 * nt + get_bits(v, 12, 3), false);
+}
 
-    char spr_pat_get(unsigned a, unsigned y, unsigned i) {
-        return spr_pat_get(16 * a + y + 8 * i);
+// v after n times inc_hor_scroll
+unsigned t_ppu::add_coarse_x(unsigned v, unsigned n) {
+    auto x = get_bits(v, 0, 5) + n;
+    copy_bits(v, 0, 5, x % 32);
+    if (x / 32 % 2 == 1) {
+        flip_bit(v, 10);
     }
+    return v;
+}
 
-    unsigned get_tile_address(unsigned adr) {
-        unsigned res = 0;
-        copy_bits(res, 0, 12, adr);
-        set_bit(res, 13);
-        return res;
+// v after inc_ver_scroll
+unsigned t_ppu::next_line_v(unsigned v) {
+    auto fine_y = get_bits(v, 12, 3);
+    if (fine_y < 7) {
+        copy_bits(v, 12, 3, fine_y + 1);
+        return v;
     }
-
-    unsigned get_fine_y_scroll() {
-        return get_bits(get_v(), 12, 3);
+    copy_bits(v, 12, 3, 0);
+    auto y = get_bits(v, 5, 5);
+    if (y == 29) {
+        y = 0;
+        flip_bit(v, 11);
+    } else if (y == 31) {
+        y = 0;
+    } else {
+        y++;
     }
+    copy_bits(v, 5, 5, y);
+    return v;
+}
 
-    void set_fine_y_scroll(unsigned x) {
-        auto y = get_v();
-        copy_bits(y, 12, 3, x);
-        set_v(y);
+// finds the first pixel of a line at which sprite 0 and the background are
+// both opaque, head holds the opaque mask of the two tiles fetched before
+// the line and v is the address the third tile is fetched from
+unsigned t_ppu::find_sprite_0_hit(unsigned head, unsigned v, char spr_mask,
+        unsigned spr_x) {
+    for (auto k = 0u; k < 8 and spr_x + k < 256; k++) {
+        if (not get_bit(spr_mask, 7 - k)) {
+            continue;
+        }
+        auto p = spr_x + k + fine_x_scroll;
+        auto opaque = false;
+        if (p < 16) {
+            opaque = get_bit(head, 15 - p);
+        } else {
+            auto mask = get_bg_row_mask(add_coarse_x(v, p / 8 - 2));
+            opaque = get_bit(mask, 7 - p % 8);
+        }
+        if (opaque) {
+            return spr_x + k;
+        }
     }
+    return no_hit;
+}
 
-    unsigned get_coarse_y_scroll() {
-        return get_bits(get_v(), 5, 5);
+// counts the dots until the sprite 0 hit of the lines ahead that have not
+// been evaluated yet, as long as no register is written, their scroll
+// follows from t and the vertical increments, and their sprite 0 row from
+// the oam, returns 0 when the hit depends on lines already under way
+unsigned long t_ppu::predict_sprite_0_hit() {
+    if (sprite_0_y_in_range or sprite_0_y_in_range_next) {
+        return 0;
     }
-
-    unsigned get_coarse_x_scroll() {
-        return get_bits(get_v(), 0, 5);
+    auto y = unsigned(oam[spr_y_ofs]);
+    auto first = y + 1;
+    auto res = ~0ul;
+    // line 0 shows the sprites evaluated on line 239
+    if (in_range(y, 232, 240)) {
+        res = get_dots_until(0, 0);
     }
-
-    void set_coarse_y_scroll(unsigned x) {
-        auto y = get_v();
-        copy_bits(y, 5, 5, x);
-        set_v(y);
+    if (in_range(ver_cnt, y, y + 9)) {
+        return 0;
     }
-
-    unsigned get_attribute_address(unsigned adr) {
-        auto res = 0u;
-        copy_bits(res, 0, 3, adr, 2);
-        copy_bits(res, 3, 3, adr, 7);
-        set_bits(res, 6, 4);
-        copy_bits(res, 10, 2, adr, 10);
-        set_bit(res, 13);
-        debug_print(log, "gaa res = %04x\n", res);
+    if (first >= 240 or (ver_cnt < 240 and ver_cnt > y)) {
         return res;
     }
 
-    void fetch_nametable_byte() {
-        nt_byte = read_mem(get_tile_address(get_v()));
-        debug_print(log, "fetch nt byte %02hhx\n", nt_byte);
+    // the vertical scroll of the first line of the sprite
+    auto v = get_v();
+    auto line = ver_cnt;
+    if (ver_cnt >= 240) {
+        if (ver_cnt < prerender_line or hor_cnt <= 304) {
+            v = tmp_adr;
+        }
+        line = 0;
+    } else if (hor_cnt > 256) {
+        line++;
     }
-
-    void fetch_attribute_table_byte() {
-        at_byte = read_mem(get_attribute_address(get_v()));
-        debug_print(log, "fetchl at byte %02hhx\n", at_byte);
+    for (; line < first; line++) {
+        v = next_line_v(v);
     }
 
-    void fetch_tile_bitmap_low() {
-        auto fy = get_fine_y_scroll();
-        tile_bitmap_low = get_bg_pattern_table_entry(nt_byte, fy, 0);
-        debug_print(log, "fetch tile bitmap low %02hhx\n", tile_bitmap_low);
+    auto base = get_bit(control_reg, 3) ? 0x1000u : 0u;
+    auto atr = oam[spr_atr_ofs];
+    auto flip = get_bit(atr, spr_atr_flip_hor_bit);
+    auto spr_x = unsigned(oam[spr_x_ofs]);
+    for (line = first; line < first + 8 and line < 240; line++) {
+        auto yy = line - first;
+        if (get_bit(atr, spr_atr_flip_ver_bit)) {
+            yy = 7 - yy;
+        }
+        auto idx = unsigned(oam[spr_idx_ofs]);
+        auto spr_mask = get_row_mask(base + 16 * idx + yy, flip);
+        copy_bits(v, 0, 5, tmp_adr, 0);
+        set_bit(v, 10, get_bit(tmp_adr, 10));
+        auto head = 256 * get_bg_row_mask(v)
+            + get_bg_row_mask(add_coarse_x(v, 1));
+        auto x = find_sprite_0_hit(head, add_coarse_x(v, 2), spr_mask, spr_x);
+        if (x != no_hit) {
+            return std::min(res, get_dots_until(line, x + 1));
+        }
+        v = next_line_v(v);
     }
+    return res;
+}
+
+void t_ppu::begin_frame() {
+    frame_skipped = not display.begin_frame();
+}
 
-    void fetch_tile_bitmap_high() {
-        auto fy = get_fine_y_scroll();
-        tile_bitmap_high = get_bg_pattern_table_entry(nt_byte, fy, 1);
-        debug_print(log, "fetch tile bitmap high %02hhx\n", tile_bitmap_high);
+void t_ppu::end_frame() {
+    if (render_pool.is_running()) {
+        render_pool.finish();
+    }
+    if (frame_skipped) {
+        display.skip_frame();
+    } else {
+        display.render();
     }
+}
 
-    void inc_hor_scroll() {
-        auto v = get_v();
-        if (get_bits(v, 0, 5) == 0x1fu) {
-            set_bits(v, 0, 5, 0);
-            flip_bit(v, 10);
-        } else {
-            v++;
+// bg and spr are what show_background and show_sprites are during the dot
+template <bool bg, bool spr>
+void t_ppu::render_pixel() {
+    auto hit_possible = bg and spr and not sprite_0_hit
+        and sprite_0_y_in_range;
+    if (frame_skipped and not hit_possible) {
+        if (hor_cnt == 256 and ver_cnt == 239) {
+            end_frame();
         }
-        set_v(v);
+        return;
     }
 
-    void inc_ver_scroll() {
-        auto fine_y = get_fine_y_scroll();
-        if (fine_y < 7) {
-            set_fine_y_scroll(fine_y + 1);
-        } else {
-            set_fine_y_scroll(0);
-            auto y = get_coarse_y_scroll();
-            if (y == 29) {
-                y = 0;
-                auto v = get_v();
-                flip_bit(v, 11);
-                set_v(v);
-            } else if (y == 31) {
-                y = 0;
-            } else {
-                y++;
+    auto background_pixel = background_fetch_pixel();
+
+    auto spr_pixel = transparent_pixel;
+    auto spr_priority = 0;
+    auto& sprite = get_sprite_pixel(0);
+    if (sprite.pal_idx != 0) {
+        if (background_pixel != transparent_pixel) {
+            if (bg and spr and sprite.zero and sprite_0_y_in_range) {
+                sprite_0_hit = true;
             }
-            set_coarse_y_scroll(y);
         }
+        spr_pixel = sprite.pal_idx;
+        logger::write(logger::level_trace, logger::cat_ppu_sprite,
+                "pix $%02hhx\n", palette[unsigned(spr_pixel)]);
+        spr_priority = not sprite.front;
     }
 
-    void reset_hor_scroll() {
-        auto v = get_v();
-        copy_bits(v, 0, 5, tmp_adr, 0);
-        set_bit(v, 10, get_bit(tmp_adr, 10));
-        set_v(v);
+    if (not frame_skipped) {
+        auto pixel = compose_pixel(background_pixel, spr_pixel, spr_priority);
+        display.send_pixel(palette_pixels[unsigned(pixel)]);
     }
-
-    void reset_ver_scroll() {
-        auto v = get_v();
-        copy_bits(v, 5, 5, tmp_adr, 5);
-        copy_bits(v, 11, 4, tmp_adr, 11);
-        set_v(v);
+    if (hor_cnt == 256 and ver_cnt == 239) {
+        end_frame();
     }
+}
 
-    char get_palette_attribute(unsigned j) {
-        auto xs = (get_coarse_x_scroll() * 8) % 32;
-        xs /= 16;
-        auto ys = (get_coarse_y_scroll() * 8 + get_fine_y_scroll()) % 32;
-        ys /= 16;
-        auto i = xs + ys * 2;
-        debug_print(log, "get_bit at_byte %u\n", 2 * i + j);
-        if (get_bit(at_byte, 2 * i + j)) {
-            return 0xff;
-        } else {
-            return 0x00;
-        }
+void t_ppu::sprite_evaluation_step() {
+    if (hor_cnt == 65) {
+        oam_idx = 0;
+        sec_oam_idx = 0;
+        copy_cnt = 0;
     }
-
-    char background_fetch_pixel() {
-        auto res = fetch_bg_pal_idx(fine_x_scroll);
-        if (res % 4 == 0) {
-            return transparent_pixel;
-        } else {
-            return get_palette_entry(res);
-        }
-    }
-
-    void render_pixel() {
-        auto background_pixel = background_fetch_pixel();
-
-        auto spr_pixel = transparent_pixel;
-        auto spr_priority = 0;
-        for (auto i = 0u; i < 8u; i++) {
-            if (spr_active[i]) {
-                debug_print(log, "spr active %u\n", i);
-                debug_print(log, "spr bitmap lo %02hhx\n", spr_bitmap_lo[i]);
-                debug_print(log, "spr bitmap hi %02hhx\n", spr_bitmap_hi[i]);
-                debug_print(log, "spr atr       %02hhx\n", spr_atr[i]);
-                auto b0 = get_bit(spr_bitmap_lo[i], 7);
-                auto b1 = get_bit(spr_bitmap_hi[i], 7);
-                auto b2 = get_bit(spr_atr[i], 0);
-                auto b3 = get_bit(spr_atr[i], 1);
-                if (not (b0 == 0 and b1 == 0)) {
-                    if (background_pixel != transparent_pixel) {
-                        if (i == 0 and sprite_0_y_in_range) {
-                            if (show_background and show_sprites) {
-                                sprite_0_hit = true;
-                            }
-                        }
-                    }
-                    auto pal_idx = bin_num_le({b0, b1, b2, b3, 1});
-                    spr_pixel = get_palette_entry(pal_idx);
-                    debug_print(log, "pix $%02hhx\n", spr_pixel);
-                    spr_priority = get_sprite_priority(i);
-                    break;
+    if (oam_idx < oam.size()) {
+        if (hor_cnt % 2 == 0) {
+            if (sec_oam_idx < sec_oam.size()) {
+                sec_oam[sec_oam_idx] = oam_data;
+                auto inr = in_range(ver_cnt, oam_data, oam_data + 8);
+                // auto d = oam_data;
+                // logger::write(logger::level_trace, logger::cat_ppu_sprite,
+                //         "in_range %u %u %u ?\n", y, d, d + 8);
+                if (oam_idx == 0) {
+                    sprite_0_y_in_range_next = inr;
                 }
-            }
-        }
-
-        auto pixel = background_pixel;
-        if (pixel == transparent_pixel) {
-            pixel = spr_pixel;
-        }
-        if (spr_priority == 0 and spr_pixel != transparent_pixel) {
-            pixel = spr_pixel;
-        }
-        if (pixel == transparent_pixel) {
-            pixel = get_palette_entry(0);
-        }
-        sdl::send_pixel(pixel);
-        if (hor_cnt == 256 and ver_cnt == 239) {
-            sdl::render();
-        }
-    }
-
-    void sprite_evaluation_step() {
-        if (hor_cnt == 65) {
-            oam_idx = 0;
-            sec_oam_idx = 0;
-            copy_cnt = 0;
-        }
-        if (oam_idx < oam.size()) {
-            if (hor_cnt % 2 == 0) {
-                if (sec_oam_idx < sec_oam.size()) {
-                    sec_oam[sec_oam_idx] = oam_data;
-                    auto inr = in_range(ver_cnt, oam_data, oam_data + 8);
-                    // auto d = oam_data;
-                    // debug_print(log, "in_range %u %u %u ?\n", y, d, d + 8);
-                    if (oam_idx == 0) {
-                        sprite_0_y_in_range_next = inr;
-                    }
-                    if (copy_cnt > 0 or inr) {
-                        sec_oam_idx++;
-                        // debug_print(log, "sec_idx = %02u\n", sec_oam_idx);
-                        oam_idx++;
-                        copy_cnt++;
-                        if (copy_cnt == 4) {
-                            copy_cnt = 0;
-                        }
-                    } else {
-                        oam_idx += 4;
+                if (copy_cnt > 0 or inr) {
+                    sec_oam_idx++;
+                    // logger::write(logger::level_trace,
+                    //         logger::cat_ppu_sprite,
+                    //         "sec_idx = %02u\n", sec_oam_idx);
+                    oam_idx++;
+                    copy_cnt++;
+                    if (copy_cnt == 4) {
+                        copy_cnt = 0;
                     }
                 } else {
                     oam_idx += 4;
                 }
             } else {
-                oam_data = oam[oam_idx];
+                oam_idx += 4;
             }
+        } else {
+            oam_data = oam[oam_idx];
         }
-        if (hor_cnt == 256) {
-            debug_print(log, "sec\n");
-            auto i = 0u;
-            while (i < 32) {
-                for (auto j = 0u; j < 4; j++) {
-                    for (auto k = 0u; k < 4; k++) {
-                        debug_print(log, " %02hhx ", sec_oam[i]);
-                        i++;
-                    }
-                    debug_print(log, " | ");
+    }
+    auto dump = logger::is_enabled(logger::level_debug, logger::cat_ppu_sprite);
+    if (hor_cnt == 256 and dump) {
+        logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                "sec\n");
+        auto i = 0u;
+        while (i < 32) {
+            for (auto j = 0u; j < 4; j++) {
+                for (auto k = 0u; k < 4; k++) {
+                    logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                            " %02hhx ", sec_oam[i]);
+                    i++;
                 }
-                debug_print(log, "\n");
+                logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                        " | ");
             }
+            logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                    "\n");
         }
     }
+}
 
-    void sprite_fetches_step() {
-        auto q = (hor_cnt - 257) / 8;
-        auto r = (hor_cnt - 257) % 8;
-        char t;
-        unsigned yy;
-        switch (r) {
-        case 0:
-            spr_active[q] = false;
-            tmp_spr_y = read_sec_oam(q, spr_y_ofs);
-            break;
-        case 1:
-            tmp_spr_idx = read_sec_oam(q, spr_idx_ofs);
-            // debug_print(log, "tile # %u\n", tmp_spr_idx);
-            // print_tile(tmp_spr_idx);
-            break;
-        case 2:
-            spr_atr[q] = read_sec_oam(q, spr_atr_ofs);
-            break;
-        case 3:
-            spr_x[q] = read_sec_oam(q, spr_x_ofs);
-            if (spr_x[q] == 0) {
-                spr_active[q] = true;
-            }
-            break;
-        case 5:
-            yy = ver_cnt - tmp_spr_y;
-            if (get_bit(spr_atr[q], spr_atr_flip_ver_bit)) {
-                yy = 7 - yy;
-            }
-            t = spr_pat_get(tmp_spr_idx, yy, 0);
-            if (get_bit(spr_atr[q], spr_atr_flip_hor_bit)) {
-                t = reverse(t);
-            }
-            spr_bitmap_lo[q] = t;
-            break;
-        case 7:
-            yy = ver_cnt - tmp_spr_y;
-            if (get_bit(spr_atr[q], spr_atr_flip_ver_bit)) {
-                yy = 7 - yy;
-            }
-            t = spr_pat_get(tmp_spr_idx, yy, 1);
-            if (get_bit(spr_atr[q], spr_atr_flip_hor_bit)) {
-                t = reverse(t);
-            }
-            spr_bitmap_hi[q] = t;
-            break;
+void t_ppu::sprite_fetches_step() {
+    auto q = (hor_cnt - 257) / 8;
+    auto r = (hor_cnt - 257) % 8;
+    char t;
+    unsigned yy;
+    switch (r) {
+    case 0:
+        advance_sprite(q);
+        spr_active[q] = false;
+        tmp_spr_y = read_sec_oam(q, spr_y_ofs);
+        break;
+    case 1:
+        tmp_spr_idx = read_sec_oam(q, spr_idx_ofs);
+        // logger::write(logger::level_trace, logger::cat_ppu_sprite,
+        //         "tile # %u\n", tmp_spr_idx);
+        // print_tile(tmp_spr_idx);
+        break;
+    case 2:
+        spr_atr[q] = read_sec_oam(q, spr_atr_ofs);
+        break;
+    case 3:
+        spr_x[q] = read_sec_oam(q, spr_x_ofs);
+        if (spr_x[q] == 0) {
+            spr_active[q] = true;
+        }
+        break;
+    case 5:
+        yy = ver_cnt - tmp_spr_y;
+        if (get_bit(spr_atr[q], spr_atr_flip_ver_bit)) {
+            yy = 7 - yy;
+        }
+        t = spr_pat_get(tmp_spr_idx, yy, 0);
+        if (get_bit(spr_atr[q], spr_atr_flip_hor_bit)) {
+            t = reverse(t);
         }
-        if (hor_cnt == 320) {
-            debug_print(log, "spr_x : ");
-            for (auto i = 0u; i < 8; i++) {
-                debug_print(log, " %02hhx", spr_x[i]);
+        spr_bitmap_lo[q] = t;
+        break;
+    case 7:
+        yy = ver_cnt - tmp_spr_y;
+        if (get_bit(spr_atr[q], spr_atr_flip_ver_bit)) {
+            yy = 7 - yy;
+        }
+        t = spr_pat_get(tmp_spr_idx, yy, 1);
+        if (get_bit(spr_atr[q], spr_atr_flip_hor_bit)) {
+            t = reverse(t);
+        }
+        spr_bitmap_hi[q] = t;
+        spr_row_adr[q] = no_row;
+        if (yy < 8) {
+            spr_row_adr[q] = 16 * tmp_spr_idx + yy;
+            if (get_bit(control_reg, 3)) {
+                spr_row_adr[q] += 0x1000u;
             }
-            debug_print(log, "\n");
         }
+        break;
     }
-
-    void inc_v() {
-        if (get_bit(control_reg, 2)) {
-            set_v(get_v() + 32);
-        } else {
-            set_v(get_v() + 1);
+    spr_rows_fresh = false;
+    spr_line_valid = false;
+    auto dump = logger::is_enabled(logger::level_debug, logger::cat_ppu_sprite);
+    if (hor_cnt == 320 and dump) {
+        logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                "spr_x : ");
+        for (auto i = 0u; i < 8; i++) {
+            logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                    " %02hhx", spr_x[i]);
         }
+        logger::write(logger::level_debug, logger::cat_ppu_sprite,
+                "\n");
     }
+}
 
-    void delayed_set() {
-        if (set_delay_active) {
-            if (set_delay == 0) {
-                gfx::set(set_adr, set_val);
-                set_delay_active = false;
-            } else {
-                set_delay--;
-            }
+void t_ppu::inc_v() {
+    if (get_bit(control_reg, 2)) {
+        set_v(get_v() + 32);
+    } else {
+        set_v(get_v() + 1);
+    }
+}
+
+void t_ppu::delayed_set() {
+    if (set_delay_active) {
+        if (set_delay == 0) {
+            set(set_adr, set_val);
+            set_delay_active = false;
+        } else {
+            set_delay--;
         }
     }
 }
 
-void gfx::load_pattern_table(std::ifstream& ifs) {
+t_ppu::t_ppu(t_machine& machine, t_display& display) :
+    machine(machine),
+    display(display) {
+}
+
+void t_ppu::load_pattern_table(std::ifstream& ifs) {
     ifs.read(&pattern_table[0], pattern_table.size());
+    tile_cached.fill(false);
+    spr_rows_fresh = false;
 }
 
-void gfx::set_with_delay(unsigned adr, char val) {
+void t_ppu::set_with_delay(unsigned adr, char val) {
     set_adr = adr;
     set_val = val;
-    set_delay = 3 * machine::get_cycle_counter() - 2;
+    set_delay = 3 * machine.get_cycle_counter() - 2;
     set_delay_active = true;
 }
 
-void gfx::set(unsigned adr, char val) {
-    debug_print(log, "set $%04x $%02hhx\n", adr, val);
+void t_ppu::set(unsigned adr, char val) {
+    logger::write(logger::level_debug, logger::cat_ppu_reg,
+            "set $%04x $%02hhx\n", adr, val);
+
+    spr_rows_fresh = false;
 
     switch (adr) {
 
@@ -604,6 +799,7 @@ void gfx::set(unsigned adr, char val) {
     case 0x2001:
         show_background = get_bit(val, 3);
         show_sprites = get_bit(val, 4);
+        select_rendering();
         break;
 
     case 0x2003:
@@ -646,7 +842,7 @@ void gfx::set(unsigned adr, char val) {
     }
 }
 
-char gfx::get(unsigned adr) {
+char t_ppu::get(unsigned adr) {
     char res = 0;
 
     switch (adr) {
@@ -673,7 +869,7 @@ char gfx::get(unsigned adr) {
     return res;
 }
 
-int gfx::init() {
+int t_ppu::init() {
     sprite_0_hit_delayed = false;
     sprite_0_hit = false;
     sprite_0_y_in_range = false;
@@ -686,68 +882,210 @@ int gfx::init() {
 
     in_vblank = false;
     frame_idx = 0;
+    frame_skipped = false;
+
+    tile_cached.fill(false);
+    spr_rows_fresh = false;
+
+    spr_clock = 0;
+    spr_base.fill(0);
+    spr_line_valid = false;
 
     set_delay_active = false;
 
     oam_adr = 0;
     control_reg = 0;
 
-    mirroring = 0;
+    memory.fill(0);
+    attribute_map.fill(0);
+    palette.fill(0);
+    palette_pixels.fill(display.get_pixel(0));
+    set_mirroring(mirroring_horizontal);
 
-    auto ret = sdl::init();
+    auto ret = display.init();
 
     show_background = 0;
     show_sprites = 0;
-
-    log = std::fopen("ppu_log.txt", "w");
-    if (log == nullptr) {
-        std::perror("ppu log opening failed ");
-        return failure;
-    }
+    select_rendering();
 
     return ret;
 }
 
-void gfx::close() {
-    std::fclose(log);
-    sdl::close();
+void t_ppu::close() {
+    render_pool.stop();
+    display.close();
+}
+
+void t_ppu::poll() {
+    display.poll();
 }
 
-void gfx::poll() {
-    sdl::poll();
+bool t_ppu::is_running() {
+    return display.is_running();
 }
 
-bool gfx::is_running() {
-    return sdl::is_running();
+bool t_ppu::should_poll() {
+    return display.should_poll();
 }
 
-bool gfx::should_poll() {
-    return sdl::should_poll();
+void t_ppu::set_frames_per_second(unsigned val) {
+    display.set_frames_per_second(val);
 }
 
-void gfx::set_frames_per_second(unsigned val) {
-    sdl::set_frames_per_second(val);
+void t_ppu::set_frame_skip(unsigned frames, bool automatic) {
+    display.set_frame_skip(frames, automatic);
 }
 
-void gfx::print_info() {
+void t_ppu::set_render_threads(unsigned threads) {
+    if (threads == 0) {
+        render_pool.stop();
+    } else {
+        render_pool.start(threads);
+    }
+}
+
+void t_ppu::print_info() {
     std::cout.flush();
     printf("h %3u  v %3u\n", hor_cnt, ver_cnt);
     std::fflush(stdout);
 }
 
-void gfx::oam_write(char val) {
+void t_ppu::oam_write(char val) {
     oam[oam_adr] = val;
     oam_adr++;
 }
 
-void gfx::set_mirroring(bool val) {
+// maps the pattern tables and the nametables of the layout into the pages,
+// 0x3000-0x3fff mirrors 0x2000-0x2fff with the palette read before the pages
+void t_ppu::set_mirroring(t_mirroring val) {
+    static const std::array<std::array<unsigned, 4>, 5> layouts = {{
+        {{ 0, 0, 1, 1 }},
+        {{ 0, 1, 0, 1 }},
+        {{ 0, 0, 0, 0 }},
+        {{ 1, 1, 1, 1 }},
+        {{ 0, 1, 2, 3 }}
+    }};
     mirroring = val;
+    nametable_pages = layouts[val];
+    for (auto i = 0u; i < 8; i++) {
+        vram_pages[i] = &pattern_table[i * vram_page_size];
+    }
+    for (auto i = 0u; i < 4; i++) {
+        auto page = &memory[nametable_pages[i] * vram_page_size];
+        vram_pages[8 + i] = page;
+        vram_pages[12 + i] = page;
+    }
+}
+
+// counts the dots to run until the one at the given position has been run,
+// including the dot skipped at the end of odd frames
+unsigned long t_ppu::get_dots_until(unsigned line, unsigned dot) {
+    auto target = line * scanline_length + dot;
+    auto cur = ver_cnt * scanline_length + hor_cnt;
+    if (cur <= target) {
+        return target - cur + 1;
+    }
+    return get_dots_until_frame_end() + target + 1;
+}
+
+unsigned long t_ppu::get_dots_until_vblank() {
+    return get_dots_until(241, 1);
+}
+
+unsigned long t_ppu::get_dots_until_render() {
+    return get_dots_until(239, 256);
+}
+
+// counts the dots to run until ver_cnt wraps around to the next frame
+unsigned long t_ppu::get_dots_until_frame_end() {
+    const auto frame_length = scanline_count * scanline_length;
+    const auto skip_dot = prerender_line * scanline_length + 339;
+    auto cur = ver_cnt * scanline_length + hor_cnt;
+    auto res = frame_length - cur;
+    if (frame_idx % 2 == 1 and cur <= skip_dot) {
+        res--;
+    }
+    return res;
 }
 
-void gfx::cycle() {
+// counts the dots until the value read from $2002 may change, which is at
+// the latest when vblank starts or ends, or when sprite 0 is predicted to
+// hit, a pending vblank flag is cleared by the next read so it changes
+// right away
+unsigned long t_ppu::get_dots_until_status_change() {
+    if (in_vblank) {
+        return 0;
+    }
+    auto res = std::min(get_dots_until_vblank(),
+            get_dots_until(prerender_line, 1));
+    if (sprite_0_hit_delayed or not (show_background and show_sprites)) {
+        return res;
+    }
+    if (sprite_0_hit) {
+        return 0;
+    }
+    return std::min(res, predict_sprite_0_hit());
+}
+
+// counts the dots until the first of the given events, the nmi is raised
+// when vblank starts or by a delayed write to the control register, so the
+// cpu can run that many dots before the ppu has to catch up
+unsigned long t_ppu::get_dots_until_event(unsigned events) {
+    auto res = ~0ul;
+    if (events & event_nmi) {
+        res = get_dots_until_vblank();
+        if (set_delay_active) {
+            res = std::min(res, set_delay + 1);
+        }
+    }
+    if (events & event_status) {
+        res = std::min(res, get_dots_until_status_change());
+    }
+    return res;
+}
+
+// calls the instance of cycle_with directly so that it can be inlined,
+// rendering only changes on $2001 writes and the line class once a line
+void t_ppu::cycle() {
+    switch (rendering) {
+    case rendering_off:
+        cycle_on_line<false, false>();
+        break;
+    case rendering_background:
+        cycle_on_line<true, false>();
+        break;
+    case rendering_sprites:
+        cycle_on_line<false, true>();
+        break;
+    case rendering_both:
+        cycle_on_line<true, true>();
+        break;
+    }
+}
+
+template <bool bg, bool spr>
+void t_ppu::cycle_on_line() {
+    if (ver_cnt < 240) {
+        cycle_with<bg, spr, line_visible>();
+    } else if (ver_cnt == prerender_line) {
+        cycle_with<bg, spr, line_prerender>();
+    } else {
+        cycle_with<bg, spr, line_idle>();
+    }
+}
+
+// keeps what $2001 enables in the form cycle picks the instances by
+void t_ppu::select_rendering() {
+    rendering = t_rendering(show_background + 2 * show_sprites);
+}
+
+// a dot of a line of the given class with rendering enabled as given, the
+// tests of what does not apply fold away in each instance
+template <bool bg, bool spr, t_ppu::t_line_class line>
+void t_ppu::cycle_with() {
     if (not started and frame_idx == 2) {
         started = true;
-        sdl::start();
+        display.start();
         frame_idx = 0;
     }
 
@@ -755,56 +1093,75 @@ void gfx::cycle() {
         sprite_0_hit_delayed = true;
     }
 
-    auto visible_line = ver_cnt < 240;
+    auto visible_line = line == line_visible;
+
+    if (visible_line and hor_cnt == 0 and ver_cnt == 0) {
+        begin_frame();
+    }
 
     if (hor_cnt == 0 and visible_line) {
-        // debug_print(log, "palette\n");
+        // logger::write(logger::level_debug, logger::cat_ppu_frame,
+        //         "palette\n");
         // for (auto j = 0u; j < 2; j++) {
         //     for (auto i = 0u; i < 16; i++) {
-        //         debug_print(log, " $%02hhx", get_palette_entry(16 * j + i));
+        //         logger::write(logger::level_debug, logger::cat_ppu_frame,
+        //                 " $%02hhx", get_palette_entry(16 * j + i));
         //     }
-        //     debug_print(log, "\n");
+        //     logger::write(logger::level_debug, logger::cat_ppu_frame,
+        //             "\n");
         // }
         sprite_0_y_in_range = sprite_0_y_in_range_next;
     }
 
-    if (hor_cnt == 0 and ver_cnt == 0 and started) {
-        debug_print(log, "tmp_adr == $%04x\n", tmp_adr);
-        debug_print(log, "nt info\n");
+    auto dump = logger::is_enabled(logger::level_debug, logger::cat_ppu_frame);
+    if (visible_line and hor_cnt == 0 and ver_cnt == 0 and started and dump) {
+        logger::write(logger::level_debug, logger::cat_ppu_frame,
+                "tmp_adr == $%04x\n", tmp_adr);
+        logger::write(logger::level_debug, logger::cat_ppu_frame,
+                "nt info\n");
         for (auto i = 0u; i < 30; i++) {
             for (auto j = 0u; j < 32; j++) {
-                debug_print(log, " %02hhx", read_mem(0x2000u + i * 32 + j));
+                logger::write(logger::level_debug, logger::cat_ppu_frame,
+                        " %02hhx", read_mem(0x2000u + i * 32 + j));
             }
-            debug_print(log, "\n");
+            logger::write(logger::level_debug, logger::cat_ppu_frame,
+                    "\n");
         }
 
-        // debug_print(log, "at table\n");
+        // logger::write(logger::level_debug, logger::cat_ppu_frame,
+        //         "at table\n");
         // for (auto i = 0u; i < 8; i++) {
         //     for (auto j = 0u; j < 8; j++) {
-        //         debug_print(log, " %02hhx", read_mem(0x23c0u + i * 8 + j));
+        //         logger::write(logger::level_debug, logger::cat_ppu_frame,
+        //                 " %02hhx", read_mem(0x23c0u + i * 8 + j));
         //     }
-        //     debug_print(log, "\n");
+        //     logger::write(logger::level_debug, logger::cat_ppu_frame,
+        //             "\n");
         // }
 
-        debug_print(log, "oam\n");
+        logger::write(logger::level_debug, logger::cat_ppu_frame,
+                "oam\n");
         auto i = 0u;
         while (i < 256) {
             for (auto j = 0u; j < 4; j++) {
                 for (auto k = 0u; k < 4; k++) {
-                    debug_print(log, " %02hhx ", oam[i]);
+                    logger::write(logger::level_debug, logger::cat_ppu_frame,
+                            " %02hhx ", oam[i]);
                     i++;
                 }
-                debug_print(log, " | ");
+                logger::write(logger::level_debug, logger::cat_ppu_frame,
+                        " | ");
             }
-            debug_print(log, "\n");
+            logger::write(logger::level_debug, logger::cat_ppu_frame,
+                    "\n");
         }
     }
 
-    if (ver_cnt < 240 and in_range(hor_cnt, 1, 257)) {
-        render_pixel();
+    if (visible_line and in_range(hor_cnt, 1, 257)) {
+        render_pixel<bg, spr>();
     }
 
-    if (show_background or show_sprites) {
+    if (bg or spr) {
         if (visible_line) {
             if (hor_cnt > 0) {
                 if (hor_cnt < 65) {
@@ -821,28 +1178,14 @@ void gfx::cycle() {
         }
     }
 
-    if (show_sprites) {
-        if (ver_cnt < 240 and in_range(hor_cnt, 1, 257)) {
-            for (auto i = 0u; i < spr_active.size(); i++) {
-                if (spr_active[i]) {
-                    spr_bitmap_lo[i] <<= 1;
-                    spr_bitmap_hi[i] <<= 1;
-                }
-            }
-            for (auto i = 0u; i < 8u; i++) {
-                if (spr_x[i] > 0) {
-                    spr_x[i]--;
-                    // debug_print(log, "spr_x[%u] = %02hhx\n", i, spr_x[i]);
-                    if (spr_x[i] == 0) {
-                        spr_active[i] = true;
-                    }
-                }
-            }
+    if (spr) {
+        if (visible_line and in_range(hor_cnt, 1, 257)) {
+            spr_clock++;
         }
     }
 
-    if (show_background) {
-        if ((ver_cnt < 240 or ver_cnt == prerender_line) and hor_cnt > 0) {
+    if (bg) {
+        if (line != line_idle and hor_cnt > 0) {
             if (hor_cnt < 257 or in_range(hor_cnt, 321, 337)) {
                 shift_tile_data();
                 auto m = (hor_cnt - 1) % 8;
@@ -867,25 +1210,25 @@ void gfx::cycle() {
         }
     }
 
-    if (ver_cnt == 241 and hor_cnt == 1) {
+    if (line == line_idle and ver_cnt == 241 and hor_cnt == 1) {
         in_vblank = true;
         gen_vblank_nmi();
     }
 
-    if (ver_cnt == prerender_line) {
+    if (line == line_prerender) {
         if (hor_cnt == 1) {
             sprite_0_hit_delayed = false;
             sprite_0_hit = false;
             in_vblank = false;
         }
         if (in_range(hor_cnt, 280, 305)) {
-            if (show_background) {
+            if (bg) {
                 reset_ver_scroll();
             }
         }
     }
 
-    if ((frame_idx % 2) == 1 and ver_cnt == 261 and hor_cnt == 339) {
+    if (line == line_prerender and frame_idx % 2 == 1 and hor_cnt == 339) {
         hor_cnt += 2;
     } else {
         hor_cnt++;
@@ -894,15 +1237,184 @@ void gfx::cycle() {
         hor_cnt = 0;
         ver_cnt++;
         if (ver_cnt < 240 or ver_cnt == prerender_line) {
-            debug_print(log, "y = %u\n", ver_cnt);
+            logger::write(logger::level_debug, logger::cat_ppu_frame,
+                    "y = %u\n", ver_cnt);
         }
         if (ver_cnt == scanline_count) {
             ver_cnt = 0;
             frame_idx++;
-            debug_print(log, "kadr nomer %lu\n", frame_idx);
+            logger::write(logger::level_debug, logger::cat_ppu_frame,
+                    "kadr nomer %lu\n", frame_idx);
             in_vblank = false;
         }
     }
 
     delayed_set();
 }
+
+// does what the 8 dots fetching a background tile do, the fetches happen
+// before the shift registers move by a whole tile and the tile is loaded
+void t_ppu::fetch_tile() {
+    fetch_nametable_byte();
+    fetch_attribute_table_byte();
+    fetch_tile_bitmap_low();
+    fetch_tile_bitmap_high();
+    for (auto& x : bg_bits) {
+        x <<= 8;
+    }
+    load_tile_data();
+    inc_hor_scroll();
+}
+
+// renders a visible line stage by stage instead of dot by dot, the stages
+// only depend on each other through the state one leaves at the end of the
+// line for the next one, so the result is the same as running cycle()
+void t_ppu::render_line() {
+    sprite_0_y_in_range = sprite_0_y_in_range_next;
+
+    // a drawn line is recorded before it is run and drawn from the record
+    // once run, here or by the pool when there are render threads
+    t_line_record* rec = nullptr;
+    auto pooled = render_pool.is_running();
+    if (not frame_skipped) {
+        auto out = display.reserve_line();
+        if (not pooled or out != nullptr) {
+            rec = pooled ? &render_pool.get_record(ver_cnt) : &line_record;
+            rec->out = out;
+            record_line(*rec);
+        }
+    }
+
+    // a line that is not drawn here only needs to know where sprite 0 hits,
+    // which the opaque masks of slot 0 and of the tiles under it tell
+    if ((rec == nullptr or pooled) and is_sprite_0_hit_possible()) {
+        advance_sprite(0);
+        auto spr_mask = spr_bitmap_lo[0] | spr_bitmap_hi[0];
+        auto spr_x0 = spr_active[0] ? 0u : unsigned(spr_x[0]);
+        if (spr_active[0] or spr_x0 > 0) {
+            auto head = get_last_bits(bg_bits[0] | bg_bits[1], 16);
+            auto x = find_sprite_0_hit(head, get_v(), spr_mask, spr_x0);
+            sprite_0_hit = x != no_hit;
+        }
+    }
+
+    if (show_sprites) {
+        spr_clock += 256;
+    }
+
+    // every fetched tile is appended to the two in the shifters, pixel x is
+    // then found at x plus the fine scroll
+    if (show_background) {
+        auto base = get_bit(control_reg, 4) ? 0x1000u : 0u;
+        for (auto i = 0u; i < 32; i++) {
+            fetch_tile();
+            if (rec == nullptr) {
+                continue;
+            }
+            auto adr = base + 16 * nt_byte + get_fine_y_scroll();
+            auto row = get_tile_row(adr, false);
+            auto atr = 4 * get_bit(bg_bits[2], 0) + 8 * get_bit(bg_bits[3], 0);
+            for (auto k = 0u; k < 8; k++) {
+                rec->bg[16 + 8 * i + k] = row[k] + atr;
+            }
+        }
+    }
+
+    if (rec != nullptr and not pooled) {
+        auto hit = compose_line(*rec);
+        if (hit and sprite_0_y_in_range and show_background and show_sprites) {
+            sprite_0_hit = true;
+        }
+    }
+    if (ver_cnt == 239) {
+        end_frame();
+    }
+
+    if (show_background) {
+        inc_ver_scroll();
+        reset_hor_scroll();
+    }
+    if (show_background or show_sprites) {
+        sec_oam.fill(0xff);
+        for (hor_cnt = 65; hor_cnt < 257; hor_cnt++) {
+            sprite_evaluation_step();
+        }
+        for (; hor_cnt < 321; hor_cnt++) {
+            sprite_fetches_step();
+        }
+        hor_cnt = 0;
+        spr_rows_fresh = true;
+    }
+    if (show_background) {
+        fetch_tile();
+        fetch_tile();
+    }
+
+    if (sprite_0_hit) {
+        sprite_0_hit_delayed = true;
+    }
+
+    if (rec != nullptr and pooled) {
+        render_pool.add(ver_cnt);
+    }
+}
+
+// records what the line is drawn from before any of it is run, the tiles
+// fetched during the line are added as they come
+void t_ppu::record_line(t_line_record& rec) {
+    rec.show_background = show_background;
+    rec.fine_x = fine_x_scroll;
+    rec.palette = palette_pixels;
+    for (auto i = 0u; i < 16; i++) {
+        rec.bg[i] = fetch_bg_pal_idx(i);
+    }
+    for (auto x = 0u; x < rec.spr_pixels.size(); x++) {
+        auto& spr = get_sprite_pixel(show_sprites ? x : 0);
+        rec.spr_pixels[x] = spr.pal_idx != 0 ? spr.pal_idx : transparent_pixel;
+        rec.spr_front[x] = spr.front ? 0xff : 0;
+        rec.spr_zero[x] = spr.zero ? 0xff : 0;
+    }
+}
+
+// runs a whole line that is not the prerender one at once
+void t_ppu::run_line() {
+    if (not started and frame_idx == 2) {
+        started = true;
+        display.start();
+        frame_idx = 0;
+    }
+
+    if (sprite_0_hit) {
+        sprite_0_hit_delayed = true;
+    }
+
+    if (ver_cnt == 0) {
+        begin_frame();
+    }
+
+    if (ver_cnt < 240) {
+        render_line();
+    } else if (ver_cnt == 241) {
+        in_vblank = true;
+        gen_vblank_nmi();
+    }
+
+    ver_cnt++;
+}
+
+// lines that start within the dots to run and contain nothing that needs
+// to be logged or delayed are run at once, the others dot by dot
+void t_ppu::run(unsigned long dots) {
+    while (dots > 0) {
+        auto whole_line = hor_cnt == 0 and ver_cnt < prerender_line
+            and dots >= scanline_length;
+        auto logged = logger::is_enabled(logger::level_debug, logger::cat_ppu);
+        if (whole_line and not logged and not set_delay_active) {
+            run_line();
+            dots -= scanline_length;
+        } else {
+            cycle();
+            dots--;
+        }
+    }
+}
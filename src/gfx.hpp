@@ -1,8 +1,37 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <fstream>
 
-namespace gfx {
+#include "render_pool.hpp"
+
+class t_machine;
+class t_display;
+
+class t_ppu {
+public:
+    // what the ppu does that the cpu can observe without writing to it, the
+    // events to wait for are passed to get_dots_until_event as a mask
+    enum t_event : unsigned {
+        event_nmi = 1u << 0,
+        event_status = 1u << 1
+    };
+
+    // how the four nametables are backed by the 2 kb of vram, four screen
+    // needs the 2 kb more a cartridge brings along
+    enum t_mirroring : unsigned {
+        mirroring_horizontal,
+        mirroring_vertical,
+        mirroring_single_low,
+        mirroring_single_high,
+        mirroring_four_screen
+    };
+
+    t_ppu(t_machine&, t_display&);
+    t_ppu(const t_ppu&) = delete;
+    t_ppu& operator=(const t_ppu&) = delete;
+
     int init();
     void load_pattern_table(std::ifstream&);
     bool is_running();
@@ -12,9 +41,204 @@ namespace gfx {
     char get(unsigned);
     void poll();
     void cycle();
+    void run(unsigned long);
     void print_info();
     void set_frames_per_second(unsigned);
+    void set_frame_skip(unsigned, bool);
+    void set_render_threads(unsigned);
     void close();
     void oam_write(char);
-    void set_mirroring(bool);
-}
+    void set_mirroring(t_mirroring);
+    unsigned long get_dots_until_vblank();
+    unsigned long get_dots_until_render();
+    unsigned long get_dots_until_frame_end();
+    unsigned long get_dots_until_event(unsigned);
+
+private:
+    t_machine& machine;
+    t_display& display;
+
+    bool sprite_0_hit_delayed;
+    bool sprite_0_hit;
+    bool sprite_0_y_in_range;
+    bool sprite_0_y_in_range_next;
+
+    unsigned copy_cnt;
+    std::array<char, 64 * 4> oam;
+    std::array<char, 8 * 4> sec_oam;
+
+    std::array<char, 8> spr_bitmap_lo;
+    std::array<char, 8> spr_bitmap_hi;
+    std::array<char, 8> spr_atr;
+    std::array<char, 8> spr_x;
+    std::array<bool, 8> spr_active;
+    std::array<unsigned, 8> spr_row_adr;
+    bool spr_rows_fresh;
+
+    // the slots stay as they were fetched, spr_clock counts the dots that
+    // shift sprites and spr_base holds its value at each fetch, the pixels
+    // of the slots are rasterized into spr_line indexed by that distance
+    struct t_spr_pixel {
+        char pal_idx;
+        bool front;
+        bool zero;
+    };
+
+    unsigned long spr_clock;
+    std::array<unsigned long, 8> spr_base;
+    std::array<t_spr_pixel, 256 + 8> spr_line;
+    unsigned long spr_line_base;
+    bool spr_line_valid;
+    unsigned oam_idx;
+    unsigned sec_oam_idx;
+    char oam_data;
+    char tmp_spr_y;
+    char tmp_spr_idx;
+
+    bool started;
+
+    bool in_vblank;
+    unsigned long frame_idx;
+
+    // a skipped frame still runs everything the cpu can observe, only the
+    // pixels that are not needed for a sprite 0 hit are not composed
+    bool frame_skipped;
+
+    // with render threads the lines are recorded and drawn by the pool,
+    // without them each line is recorded in line_record and drawn at once
+    t_render_pool render_pool;
+    t_line_record line_record;
+
+    unsigned hor_cnt;
+    unsigned ver_cnt;
+
+    unsigned set_adr;
+    char set_val;
+    unsigned long set_delay;
+    bool set_delay_active;
+
+    char oam_adr;
+    char control_reg;
+    char data_read_buffer;
+
+    std::array<char, 0x1000> memory;
+    std::array<char, 0x2000> pattern_table;
+
+    // the 16 kb the ppu addresses in pages of 1 kb, rebuilt on a change of
+    // the mirroring so that a fetch is a lookup
+    static constexpr unsigned vram_page_size = 0x400;
+    std::array<char*, 0x4000 / vram_page_size> vram_pages;
+    std::array<unsigned, 4> nametable_pages;
+
+    // for every nametable the palette of each of its 32 by 32 tiles as the
+    // attribute bytes written to it select them, indexed like v
+    static constexpr unsigned attribute_map_size = 32 * 32;
+    std::array<char, 4 * attribute_map_size> attribute_map;
+
+    // pattern table rows decoded into 2 bit pixels, for every tile the 8
+    // rows as they are followed by the 8 rows flipped horizontally
+    std::array<char, 0x2000 / 16 * 2 * 8 * 8> tile_cache;
+    std::array<bool, 0x2000 / 16> tile_cached;
+    std::array<char, 0x20> palette;
+
+    // the palette as pixels of the display, updated on palette writes
+    std::array<uint32_t, 0x20> palette_pixels;
+
+    unsigned cur_adr;
+    unsigned tmp_adr;
+    unsigned fine_x_scroll;
+    bool write_toggle;
+
+    t_mirroring mirroring;
+
+    char nt_byte;
+    char at_bits;
+    char tile_bitmap_low;
+    char tile_bitmap_high;
+
+    std::array<unsigned, 4> bg_bits;
+
+    bool show_background;
+    bool show_sprites;
+
+    // what a dot does depends on the line it is on and on the rendering
+    // enabled, cycle runs the instance of cycle_with for both
+    enum t_line_class : unsigned {
+        line_visible,
+        line_idle,
+        line_prerender
+    };
+    enum t_rendering : unsigned {
+        rendering_off,
+        rendering_background,
+        rendering_sprites,
+        rendering_both
+    };
+    t_rendering rendering;
+
+    void print_tile(unsigned);
+    void decode_tile(unsigned);
+    const char* get_tile_row(unsigned, bool);
+    char read_sec_oam(unsigned, unsigned);
+    void set_v(unsigned);
+    unsigned get_v();
+    unsigned canonize_adr(unsigned);
+    unsigned get_palette_index(unsigned);
+    unsigned get_sprite_priority(unsigned);
+    void load_tile_data();
+    void shift_tile_data();
+    char fetch_bg_pal_idx(unsigned);
+    bool get_nmi_output_flag();
+    void gen_vblank_nmi();
+    void write_mem(unsigned, char);
+    char read_mem(unsigned);
+    char get_palette_entry(unsigned);
+    char get_bg_pattern_table_entry(unsigned);
+    char get_bg_pattern_table_entry(unsigned, unsigned, unsigned);
+    char spr_pat_get(unsigned);
+    char spr_pat_get(unsigned, unsigned, unsigned);
+    unsigned get_tile_address(unsigned);
+    unsigned get_fine_y_scroll();
+    void set_fine_y_scroll(unsigned);
+    unsigned get_coarse_y_scroll();
+    unsigned get_coarse_x_scroll();
+    void set_coarse_y_scroll(unsigned);
+    void fetch_nametable_byte();
+    void fetch_attribute_table_byte();
+    void fetch_tile_bitmap_low();
+    void fetch_tile_bitmap_high();
+    void inc_hor_scroll();
+    void inc_ver_scroll();
+    void reset_hor_scroll();
+    void reset_ver_scroll();
+    void update_attribute_map(unsigned, char);
+    char get_bg_pixel(unsigned);
+    char background_fetch_pixel();
+    char compose_pixel(char, char, unsigned);
+    bool is_sprite_0_hit_possible();
+    char get_row_mask(unsigned, bool);
+    char get_bg_row_mask(unsigned);
+    unsigned add_coarse_x(unsigned, unsigned);
+    unsigned next_line_v(unsigned);
+    unsigned find_sprite_0_hit(unsigned, unsigned, char, unsigned);
+    unsigned long predict_sprite_0_hit();
+    void begin_frame();
+    void end_frame();
+    template <bool bg, bool spr> void render_pixel();
+    void select_rendering();
+    template <bool bg, bool spr> void cycle_on_line();
+    template <bool bg, bool spr, t_line_class line> void cycle_with();
+    void advance_sprite(unsigned);
+    void build_sprite_line();
+    const t_spr_pixel& get_sprite_pixel(unsigned long);
+    void sprite_evaluation_step();
+    void sprite_fetches_step();
+    void inc_v();
+    void delayed_set();
+    unsigned long get_dots_until(unsigned, unsigned);
+    unsigned long get_dots_until_status_change();
+    void fetch_tile();
+    void record_line(t_line_record&);
+    void render_line();
+    void run_line();
+};
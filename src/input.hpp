@@ -1,6 +1,19 @@
 #pragma once
 
-namespace input {
+class t_display;
+
+class t_input {
+public:
+    t_input(t_display&);
+    t_input(const t_input&) = delete;
+    t_input& operator=(const t_input&) = delete;
+
     char read();
     void write(char);
-}
+
+private:
+    t_display& display;
+
+    unsigned cnt;
+    bool prev_value;
+};
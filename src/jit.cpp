@@ -0,0 +1,190 @@
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+#include "jit.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_X86_64 1
+#else
+#define JIT_X86_64 0
+#endif
+
+namespace {
+    const auto arena_size = 0x400000u;
+    const auto max_code_size = 0x1000u;
+    const auto max_exits = 0x40u;
+
+    // assembles into the buffers of the arena, which keep their capacity
+    // from one block to the next
+    struct t_assembler {
+        std::vector<unsigned char>& code;
+        std::vector<unsigned>& exits;
+
+        void emit(std::initializer_list<unsigned char> bytes) {
+            code.insert(code.end(), bytes);
+        }
+
+        void emit_32(uint32_t x) {
+            for (auto i = 0u; i < 4; i++) {
+                code.push_back(x >> (8 * i));
+            }
+        }
+
+        void emit_64(uint64_t x) {
+            for (auto i = 0u; i < 8; i++) {
+                code.push_back(x >> (8 * i));
+            }
+        }
+
+        // jcc rel32 to the common exit, patched once the block is complete
+        void emit_exit_jump(unsigned char cc) {
+            emit({0x0f, cc});
+            exits.push_back(code.size());
+            emit_32(0);
+        }
+
+        // registers across the block :
+        //   rbx  cycle budget
+        //   r12  &cycle_count
+        //   r13  &pc
+        //   r14  &step_count
+        //   r15  machine
+
+        void emit_prologue(const jit::t_state& st) {
+            emit({0x53});                         // push rbx
+            emit({0x41, 0x54});                   // push r12
+            emit({0x41, 0x55});                   // push r13
+            emit({0x41, 0x56});                   // push r14
+            emit({0x41, 0x57});                   // push r15
+            emit({0x48, 0x89, 0xfb});             // mov rbx, rdi
+            emit({0x49, 0xbc});                   // mov r12, imm64
+            emit_64(reinterpret_cast<uintptr_t>(st.cycle_count));
+            emit({0x49, 0xbd});                   // mov r13, imm64
+            emit_64(reinterpret_cast<uintptr_t>(st.pc));
+            emit({0x49, 0xbe});                   // mov r14, imm64
+            emit_64(reinterpret_cast<uintptr_t>(st.step_count));
+            emit({0x49, 0xbf});                   // mov r15, imm64
+            emit_64(reinterpret_cast<uintptr_t>(st.machine));
+        }
+
+        void emit_instr(const jit::t_instr& instr, bool first) {
+            if (not first) {
+                emit({0x49, 0x39, 0x1c, 0x24});   // cmp [r12], rbx
+                emit_exit_jump(0x83);             // jae exit
+            }
+            emit({0x49, 0xc7, 0x45, 0x00});       // mov qword [r13], imm32
+            emit_32(instr.next_pc);
+            emit({0x4c, 0x89, 0xff});             // mov rdi, r15
+            emit({0xbe});                         // mov esi, imm32
+            emit_32(instr.operand);
+            emit({0x48, 0xb8});                   // mov rax, imm64
+            emit_64(reinterpret_cast<uintptr_t>(instr.exec));
+            emit({0xff, 0xd0});                   // call rax
+            emit({0x49, 0x83, 0x04, 0x24});       // add qword [r12], imm8
+            emit({static_cast<unsigned char>(instr.cycles)});
+            if (instr.page_penalty) {
+                emit({0x0f, 0xb6, 0xc0});         // movzx eax, al
+                emit({0x49, 0x01, 0x04, 0x24});   // add [r12], rax
+            }
+            emit({0x49, 0x83, 0x06, 0x01});       // add qword [r14], 1
+            if (instr.branch) {
+                emit({0x49, 0x81, 0x7d, 0x00});   // cmp qword [r13], imm32
+                emit_32(instr.next_pc);
+                emit_exit_jump(0x85);             // jne exit
+            }
+        }
+
+        void emit_epilogue() {
+            auto exit = code.size();
+            for (auto pos : exits) {
+                uint32_t rel = exit - (pos + 4);
+                std::memcpy(&code[pos], &rel, 4);
+            }
+            emit({0x41, 0x5f});                   // pop r15
+            emit({0x41, 0x5e});                   // pop r14
+            emit({0x41, 0x5d});                   // pop r13
+            emit({0x41, 0x5c});                   // pop r12
+            emit({0x5b});                         // pop rbx
+            emit({0xc3});                         // ret
+        }
+    };
+}
+
+bool jit::is_supported() {
+    return JIT_X86_64;
+}
+
+jit::t_arena::t_arena() : mem(nullptr), used(0), full(false) {
+    code.reserve(max_code_size);
+    exits.reserve(max_exits);
+}
+
+jit::t_arena::~t_arena() {
+#if JIT_X86_64
+    if (mem != nullptr) {
+        munmap(mem, arena_size);
+    }
+#endif
+}
+
+jit::t_block jit::t_arena::compile(const std::vector<t_instr>& instrs,
+        const t_state& st) {
+    if (instrs.empty()) {
+        return nullptr;
+    }
+#if JIT_X86_64
+    if (mem == nullptr) {
+        auto prot = PROT_READ | PROT_EXEC;
+        auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        auto p = mmap(nullptr, arena_size, prot, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        mem = static_cast<unsigned char*>(p);
+        used = 0;
+    }
+#else
+    return nullptr;
+#endif
+    code.clear();
+    exits.clear();
+    t_assembler as = { code, exits };
+    as.emit_prologue(st);
+    for (auto i = 0u; i < instrs.size(); i++) {
+        as.emit_instr(instrs[i], i == 0);
+    }
+    as.emit_epilogue();
+    if (used + as.code.size() > arena_size) {
+        full = true;
+        return nullptr;
+    }
+    // the arena is only writable while a block is copied into it
+#if JIT_X86_64
+    if (mprotect(mem, arena_size, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+    auto dst = mem + used;
+    std::memcpy(dst, as.code.data(), as.code.size());
+    if (mprotect(mem, arena_size, PROT_READ | PROT_EXEC) != 0) {
+        return nullptr;
+    }
+    used += as.code.size();
+    return reinterpret_cast<t_block>(dst);
+#else
+    return nullptr;
+#endif
+}
+
+// whether a block did not fit, the blocks in it have to be dropped with
+// reset before more can be compiled
+bool jit::t_arena::is_full() {
+    return full;
+}
+
+// forgets the blocks compiled so far and keeps the memory for the next ones
+void jit::t_arena::reset() {
+    used = 0;
+    full = false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "misc.hpp"
+
+class t_machine;
+
+// a call threaded backend only, a block becomes native code that runs its
+// instructions by calling the handlers of the interpreter one after another,
+// it saves the dispatch of the block cache but no instruction, not even a
+// load, store, increment or branch, is inlined. measured over 2000 frames
+// with idle loop skipping off, the cpu side (time outside of the ppu) went
+// from 0.38s to 0.24s on nesdoug-26 and from 0.33s to 0.37s on
+// hello_world_x, with idle loop skipping on the cpu side is under 2% of the
+// run and the whole run time does not change beyond noise
+namespace jit {
+    // one translated instruction, the code sets pc to next_pc, calls exec
+    // with the machine and the operand and adds the cycles, a branch leaves
+    // the block when it is taken
+    struct t_instr {
+        bool (*exec)(t_machine&, t_adr);
+        t_adr operand;
+        t_adr next_pc;
+        unsigned cycles;
+        bool page_penalty;
+        bool branch;
+    };
+
+    struct t_state {
+        t_machine* machine;
+        unsigned long* cycle_count;
+        t_adr* pc;
+        unsigned long* step_count;
+    };
+
+    // runs the block, every instruction but the first one is skipped once
+    // the cycle count reaches the budget
+    using t_block = void (*)(unsigned long);
+
+    bool is_supported();
+
+    // executable memory for the blocks of one machine, mapped read and
+    // execute and only made writable while a block is copied in
+    class t_arena {
+        unsigned char* mem;
+        unsigned used;
+        bool full;
+        std::vector<unsigned char> code;
+        std::vector<unsigned> exits;
+    public:
+        t_arena();
+        ~t_arena();
+        t_arena(const t_arena&) = delete;
+        t_arena& operator=(const t_arena&) = delete;
+        t_block compile(const std::vector<t_instr>&, const t_state&);
+        bool is_full();
+        void reset();
+    };
+}
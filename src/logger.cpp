@@ -0,0 +1,128 @@
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+
+#include "logger.hpp"
+#include "misc.hpp"
+
+logger::t_level logger::cur_level = logger::level_error;
+unsigned logger::cur_categories = 0;
+
+namespace {
+    // single producer single consumer ring, the emulator pushes and the
+    // writer thread drains, a full ring makes the emulator wait
+    const auto ring_size = 1u << 16;
+
+    std::vector<logger::t_event> ring;
+    std::atomic<unsigned long> head(0);
+    std::atomic<unsigned long> tail(0);
+    std::atomic<bool> stopping(false);
+    std::thread writer;
+    FILE* file = nullptr;
+
+    // the conversions an event can use, all of them take an integer, and
+    // what may come between them and the %
+    const std::string conversions = "diouxXc%";
+    const std::string modifiers = "-+ #0123456789.hl";
+
+    // formats the event like printf would, every conversion takes the next
+    // argument as unsigned long when it has an l modifier, else as unsigned
+    void format(const logger::t_event& event) {
+        std::string spec;
+        auto arg = 0u;
+        for (auto p = event.fmt; *p != '\0'; p++) {
+            if (*p != '%') {
+                std::fputc(*p, file);
+                continue;
+            }
+            spec = "%";
+            while (*++p != '\0') {
+                spec += *p;
+                if (conversions.find(*p) != std::string::npos) {
+                    break;
+                }
+                assert(modifiers.find(*p) != std::string::npos
+                        and "log conversion that takes no integer");
+            }
+            assert(*p != '\0' and "log conversion cut off");
+            if (*p == '\0') {
+                break;
+            }
+            assert((*p == '%' or arg < event.args.size())
+                    and "more log conversions than arguments");
+            if (*p == '%') {
+                std::fputc('%', file);
+            } else if (spec.find('l') != std::string::npos) {
+                std::fprintf(file, spec.c_str(), event.args[arg++]);
+            } else {
+                std::fprintf(file, spec.c_str(), unsigned(event.args[arg++]));
+            }
+        }
+    }
+
+    void drain() {
+        while (true) {
+            auto stop = stopping.load();
+            auto t = tail.load(std::memory_order_relaxed);
+            auto h = head.load(std::memory_order_acquire);
+            if (t == h) {
+                if (stop) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            for (; t != h; t++) {
+                format(ring[t % ring_size]);
+            }
+            tail.store(t, std::memory_order_release);
+        }
+        std::fflush(file);
+    }
+}
+
+void logger::push(const t_event& event) {
+    if (file == nullptr) {
+        return;
+    }
+    auto h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == ring_size) {
+        std::this_thread::yield();
+    }
+    ring[h % ring_size] = event;
+    head.store(h + 1, std::memory_order_release);
+}
+
+int logger::open(const char* path) {
+    file = std::fopen(path, "w");
+    if (file == nullptr) {
+        std::perror("log opening failed ");
+        return failure;
+    }
+    ring.resize(ring_size);
+    stopping = false;
+    writer = std::thread(drain);
+    return success;
+}
+
+void logger::close() {
+    if (file == nullptr) {
+        return;
+    }
+    stopping = true;
+    writer.join();
+    std::fclose(file);
+    file = nullptr;
+}
+
+void logger::set_level(t_level level) {
+    cur_level = level;
+}
+
+void logger::set_categories(unsigned categories) {
+    cur_categories = categories;
+}
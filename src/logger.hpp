@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+
+// the log is one for the whole process, the consoles of a process share its
+// level, categories, file and writer thread, so only one should log at a time
+namespace logger {
+    enum t_level : unsigned {
+        level_error,
+        level_info,
+        level_debug,
+        level_trace
+    };
+
+    enum t_category : unsigned {
+        cat_ppu_reg = 1u << 0,
+        cat_ppu_fetch = 1u << 1,
+        cat_ppu_sprite = 1u << 2,
+        cat_ppu_frame = 1u << 3,
+        cat_ppu = cat_ppu_reg | cat_ppu_fetch | cat_ppu_sprite | cat_ppu_frame
+    };
+
+    // events above this level are compiled out together with their checks,
+    // build with LOG_LEVEL=level_debug or level_trace for the ones of the ppu
+#ifdef LOG_LEVEL
+    const auto compiled_level = LOG_LEVEL;
+#else
+    const auto compiled_level = level_info;
+#endif
+
+    extern t_level cur_level;
+    extern unsigned cur_categories;
+
+    inline bool is_enabled(t_level level, unsigned categories) {
+        return level <= compiled_level and level <= cur_level
+            and (categories & cur_categories) != 0;
+    }
+
+    // an event only stores the format and its integer arguments, they are
+    // formatted by the thread writing the log
+    struct t_event {
+        const char* fmt;
+        std::array<unsigned long, 4> args;
+    };
+
+    void push(const t_event&);
+
+    template <class... t_args>
+    void write(t_level level, unsigned categories, const char* fmt,
+            t_args... args) {
+        static_assert(sizeof...(args) <= 4, "too many log arguments");
+        if (is_enabled(level, categories)) {
+            push({ fmt, { (unsigned long)(args)... } });
+        }
+    }
+
+    int open(const char*);
+    void close();
+    void set_level(t_level);
+    void set_categories(unsigned);
+}
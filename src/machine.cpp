@@ -4,167 +4,25 @@
 #include <algorithm>
 #include <iomanip>
 #include <functional>
+#include <cstring>
 
 #include "machine.hpp"
 #include "misc.hpp"
 #include "gfx.hpp"
 #include "input.hpp"
+#include "jit.hpp"
 
 namespace {
-    bool reset_flag;
-    bool nmi_flag;
-    bool irq_flag;
-
-    bool ready;
-
-    std::array<char, 0x0800> memory;
-    std::vector<char> prg_rom;
-
-    t_adr arg;
-    unsigned r_cyc;
-    unsigned w_cyc;
-    unsigned long step_count;
-    unsigned long cycle_count;
-    bool odd_cycle;
-    std::string instr_arg_str;
-    unsigned cur_opcode;
-
-    // registers
-
-    t_adr pc; // program counter
-    char sp; // stack pointer
-    char ra; // accumulator
-    char rx; // x
-    char ry; // y
-    char rp; // processor status
-
-    // addresses
-
-    const t_adr adr_ra = 0x10000;
-    const t_adr adr_rx = 0x10001;
-    const t_adr adr_ry = 0x10002;
-    const t_adr adr_rp = 0x10003;
-    const t_adr adr_sp = 0x10004;
-
-    // declarations
-
-    // addressing modes
-
-    void m_imp();
-    void m_acc();
-    void m_imm();
-    void m_rel();
-    void m_zpg();
-    void m_zpx();
-    void m_zpy();
-    void m_abs();
-    void m_abx();
-    void m_aby();
-    void m_ind();
-    void m_inx();
-    void m_iny();
-
-    // instructions
-
-    void i_lda();
-    void i_ldx();
-    void i_ldy();
-
-    void i_sta();
-    void i_stx();
-    void i_sty();
-
-    void i_tax();
-    void i_tay();
-    void i_txa();
-    void i_tya();
-    void i_tsx();
-    void i_txs();
-
-    void i_pha();
-    void i_pla();
-
-    void i_php();
-    void i_plp();
-
-    void i_and();
-    void i_eor();
-    void i_ora();
-    void i_bit();
-
-    void i_inc();
-    void i_dec();
-
-    void i_inx();
-    void i_dex();
-    void i_iny();
-    void i_dey();
-
-    void i_jmp();
-    void i_jsr();
-    void i_rts();
-
-    void i_clc();
-    void i_sec();
-    void i_clv();
-    void i_cld();
-    void i_sed();
-    void i_cli();
-    void i_sei();
-
-    void i_bcc();
-    void i_bcs();
-    void i_bpl();
-    void i_bmi();
-    void i_bne();
-    void i_beq();
-    void i_bvc();
-    void i_bvs();
-
-    void i_brk();
-    void i_rti();
-    void i_nop();
-
-    void i_asl();
-    void i_lsr();
-    void i_rol();
-    void i_ror();
-
-    void i_adc();
-    void i_sbc();
-    void i_cmp();
-    void i_cpx();
-    void i_cpy();
-
-    void i_isc();
-
-    // helper functions
-
-    void set_carry_flag(bool);
-    bool get_carry_flag();
-    void set_zero_flag(bool);
-    bool get_zero_flag();
-    void set_overflow_flag(bool);
-    bool get_overflow_flag();
-    void set_negative_flag(bool);
-    bool get_negative_flag();
-    void set_interrupt_disable_flag(bool);
-    bool get_interrupt_disable_flag();
-    void set_break_flag(bool);
-    bool get_break_flag();
-    char read_mem(t_adr);
-    t_adr read_mem_2(t_adr);
-    void write_mem(t_adr, char);
-    void set_with_flags(t_adr, char);
-    void set_arg(t_adr, int);
-    void push(char);
-    char pull();
-    void push_adr(t_adr);
-    t_adr pull_adr();
-    void short_jump_if(bool);
-    const char* get_opcode_str(unsigned);
-
-    // definitions
+    const auto page_size = 0x100u;
+    const auto prg_rom_start = 0x8000u;
+    const auto max_block_length = 32u;
+    const auto jit_threshold = 16u;
+    const auto min_jit_length = 2u;
+    const auto block_pool_size = 0x10000u;
+    const auto max_spin_length = 8u;
+    // dots the cpu runs ahead before handing them to the ppu thread, a
+    // scanline keeps the thread busy without filling the journal
+    const auto ppu_post_interval = 341u;
 
     t_adr make_adr(char hi, char lo) {
         return (t_adr(hi) << 8) | lo;
@@ -187,1113 +45,1376 @@ namespace {
         return adr;
     }
 
-    void process_interrupt() {
-        if (nmi_flag) {
-            // log_print_line("interrupt nmi");
-            nmi_flag = 0;
-            push_adr(pc);
-            auto val = rp;
-            set_bit(val, 5, 1);
-            set_bit(val, 4, 0);
-            push(val);
-            set_interrupt_disable_flag(1);
-            pc = read_mem_2(0xfffa);
-        }
-        if (reset_flag) {
-            // log_print_line("interrupt reset");
-            reset_flag = 0;
-            set_interrupt_disable_flag(1);
-            pc = read_mem_2(0xfffc);
-        } else if (irq_flag) {
-            // log_print_line("interrupt irq");
-            irq_flag = 0;
-            push_adr(pc);
-            auto val = rp;
-            set_bit(val, 5, 1);
-            set_bit(val, 4, 0);
-            push(val);
-            set_interrupt_disable_flag(1);
-            pc = read_mem_2(0xfffe);
+    bool ends_block(char opcode) {
+        switch (opcode) {
+        case 0x00: case 0x20: case 0x40: case 0x4c: case 0x60: case 0x6c:
+            return true;
+        default:
+            return false;
         }
     }
 
-    int step() {
-        // getchar();
-
-        auto idf = get_interrupt_disable_flag();
-        if (nmi_flag or reset_flag or (not idf and irq_flag)) {
-            process_interrupt();
-            cycle_count = 6;
-            return 0;
-        }
+    bool is_plain_memory(t_adr first, t_adr last) {
+        auto in_ram = last < 0x2000u;
+        auto in_prg_rom = first >= prg_rom_start and last < 0x10000u;
+        return in_ram or in_prg_rom;
+    }
 
-        // log_print_str("a "); log_print_hex(ra, 2);
-        // log_print_str(" | x "); log_print_hex(rx, 2);
-        // log_print_str(" | y "); log_print_hex(ry, 2);
-        // log_print_str(" | p "); log_print_hex(rp, 2);
-        // log_print_str(" | sp "); log_print_hex(sp, 2);
-        // log_print_str(" | ");
-
-        // log_print_hex(pc, 4);
-
-        // fetch an instruction
-        cur_opcode = read_mem(pc);
-        pc++;
-
-        // log_print_str("  ");
-        // log_set_width(10);
-        // log_print_hex(cur_opcode, 2);
-
-        // execute the given instruction
-        switch (cur_opcode) {
-        case 0x29: m_imm(); i_and(); break;
-        case 0x25: m_zpg(); i_and(); break;
-        case 0x35: m_zpx(); i_and(); break;
-        case 0x2d: m_abs(); i_and(); break;
-        case 0x3d: m_abx(); i_and(); break;
-        case 0x39: m_aby(); i_and(); break;
-        case 0x21: m_inx(); i_and(); break;
-        case 0x31: m_iny(); i_and(); break;
-
-        case 0x49: m_imm(); i_eor(); break;
-        case 0x45: m_zpg(); i_eor(); break;
-        case 0x55: m_zpx(); i_eor(); break;
-        case 0x4d: m_abs(); i_eor(); break;
-        case 0x5d: m_abx(); i_eor(); break;
-        case 0x59: m_aby(); i_eor(); break;
-        case 0x41: m_inx(); i_eor(); break;
-        case 0x51: m_iny(); i_eor(); break;
-
-        case 0x09: m_imm(); i_ora(); break;
-        case 0x05: m_zpg(); i_ora(); break;
-        case 0x15: m_zpx(); i_ora(); break;
-        case 0x0d: m_abs(); i_ora(); break;
-        case 0x1d: m_abx(); i_ora(); break;
-        case 0x19: m_aby(); i_ora(); break;
-        case 0x01: m_inx(); i_ora(); break;
-        case 0x11: m_iny(); i_ora(); break;
-
-        case 0x24: m_zpg(); i_bit(); break;
-        case 0x2c: m_abs(); i_bit(); break;
-
-        case 0xa9: m_imm(); i_lda(); break;
-        case 0xa5: m_zpg(); i_lda(); break;
-        case 0xb5: m_zpx(); i_lda(); break;
-        case 0xad: m_abs(); i_lda(); break;
-        case 0xbd: m_abx(); i_lda(); break;
-        case 0xb9: m_aby(); i_lda(); break;
-        case 0xa1: m_inx(); i_lda(); break;
-        case 0xb1: m_iny(); i_lda(); break;
-
-        case 0xa2: m_imm(); i_ldx(); break;
-        case 0xa6: m_zpg(); i_ldx(); break;
-        case 0xb6: m_zpy(); i_ldx(); break;
-        case 0xae: m_abs(); i_ldx(); break;
-        case 0xbe: m_aby(); i_ldx(); break;
-
-        case 0xa0: m_imm(); i_ldy(); break;
-        case 0xa4: m_zpg(); i_ldy(); break;
-        case 0xb4: m_zpx(); i_ldy(); break;
-        case 0xac: m_abs(); i_ldy(); break;
-        case 0xbc: m_abx(); i_ldy(); break;
-
-        case 0x85: m_zpg(); i_sta(); break;
-        case 0x95: m_zpx(); i_sta(); break;
-        case 0x8d: m_abs(); i_sta(); break;
-        case 0x9d: m_abx(); i_sta(); break;
-        case 0x99: m_aby(); i_sta(); break;
-        case 0x81: m_inx(); i_sta(); break;
-        case 0x91: m_iny(); i_sta(); break;
-
-        case 0x86: m_zpg(); i_stx(); break;
-        case 0x96: m_zpy(); i_stx(); break;
-        case 0x8e: m_abs(); i_stx(); break;
-
-        case 0x84: m_zpg(); i_sty(); break;
-        case 0x94: m_zpx(); i_sty(); break;
-        case 0x8c: m_abs(); i_sty(); break;
-
-        case 0xaa: m_imp(); i_tax(); break;
-        case 0xa8: m_imp(); i_tay(); break;
-        case 0x8a: m_imp(); i_txa(); break;
-        case 0x98: m_imp(); i_tya(); break;
-
-        case 0xe6: m_zpg(); i_inc(); break;
-        case 0xf6: m_zpx(); i_inc(); break;
-        case 0xee: m_abs(); i_inc(); break;
-        case 0xfe: m_abx(); i_inc(); break;
-        case 0xe8: m_imp(); i_inx(); break;
-        case 0xc8: m_imp(); i_iny(); break;
-
-        case 0xc6: m_zpg(); i_dec(); break;
-        case 0xd6: m_zpx(); i_dec(); break;
-        case 0xce: m_abs(); i_dec(); break;
-        case 0xde: m_abx(); i_dec(); break;
-        case 0xca: m_imp(); i_dex(); break;
-        case 0x88: m_imp(); i_dey(); break;
-
-        case 0x0a: m_acc(); i_asl(); break;
-        case 0x06: m_zpg(); i_asl(); break;
-        case 0x16: m_zpx(); i_asl(); break;
-        case 0x0e: m_abs(); i_asl(); break;
-        case 0x1e: m_abx(); i_asl(); break;
-
-        case 0x4a: m_acc(); i_lsr(); break;
-        case 0x46: m_zpg(); i_lsr(); break;
-        case 0x56: m_zpx(); i_lsr(); break;
-        case 0x4e: m_abs(); i_lsr(); break;
-        case 0x5e: m_abx(); i_lsr(); break;
-
-        case 0x2a: m_acc(); i_rol(); break;
-        case 0x26: m_zpg(); i_rol(); break;
-        case 0x36: m_zpx(); i_rol(); break;
-        case 0x2e: m_abs(); i_rol(); break;
-        case 0x3e: m_abx(); i_rol(); break;
-
-        case 0x6a: m_acc(); i_ror(); break;
-        case 0x66: m_zpg(); i_ror(); break;
-        case 0x76: m_zpx(); i_ror(); break;
-        case 0x6e: m_abs(); i_ror(); break;
-        case 0x7e: m_abx(); i_ror(); break;
-
-        case 0xba: m_imp(); i_tsx(); break;
-        case 0x9a: m_imp(); i_txs(); break;
-        case 0x48: m_imp(); i_pha(); break;
-        case 0x08: m_imp(); i_php(); break;
-        case 0x68: m_imp(); i_pla(); break;
-        case 0x28: m_imp(); i_plp(); break;
-
-        case 0x4c: m_abs(); i_jmp(); break;
-        case 0x6c: m_ind(); i_jmp(); break;
-        case 0x20: m_abs(); i_jsr(); break;
-        case 0x60: m_imp(); i_rts(); break;
-
-        case 0x90: m_rel(); i_bcc(); break;
-        case 0xb0: m_rel(); i_bcs(); break;
-        case 0xf0: m_rel(); i_beq(); break;
-        case 0x30: m_rel(); i_bmi(); break;
-        case 0xd0: m_rel(); i_bne(); break;
-        case 0x10: m_rel(); i_bpl(); break;
-        case 0x50: m_rel(); i_bvc(); break;
-        case 0x70: m_rel(); i_bvs(); break;
-
-        case 0x18: m_imp(); i_clc(); break;
-        case 0xd8: m_imp(); i_cld(); break;
-        case 0x58: m_imp(); i_cli(); break;
-        case 0xb8: m_imp(); i_clv(); break;
-        case 0x38: m_imp(); i_sec(); break;
-        case 0xf8: m_imp(); i_sed(); break;
-        case 0x78: m_imp(); i_sei(); break;
-
-        case 0x69: m_imm(); i_adc(); break;
-        case 0x65: m_zpg(); i_adc(); break;
-        case 0x75: m_zpx(); i_adc(); break;
-        case 0x6d: m_abs(); i_adc(); break;
-        case 0x7d: m_abx(); i_adc(); break;
-        case 0x79: m_aby(); i_adc(); break;
-        case 0x61: m_inx(); i_adc(); break;
-        case 0x71: m_iny(); i_adc(); break;
-
-        case 0xe9: m_imm(); i_sbc(); break;
-        case 0xe5: m_zpg(); i_sbc(); break;
-        case 0xf5: m_zpx(); i_sbc(); break;
-        case 0xed: m_abs(); i_sbc(); break;
-        case 0xfd: m_abx(); i_sbc(); break;
-        case 0xf9: m_aby(); i_sbc(); break;
-        case 0xe1: m_inx(); i_sbc(); break;
-        case 0xf1: m_iny(); i_sbc(); break;
-
-        case 0xc9: m_imm(); i_cmp(); break;
-        case 0xc5: m_zpg(); i_cmp(); break;
-        case 0xd5: m_zpx(); i_cmp(); break;
-        case 0xcd: m_abs(); i_cmp(); break;
-        case 0xdd: m_abx(); i_cmp(); break;
-        case 0xd9: m_aby(); i_cmp(); break;
-        case 0xc1: m_inx(); i_cmp(); break;
-        case 0xd1: m_iny(); i_cmp(); break;
-
-        case 0xe0: m_imm(); i_cpx(); break;
-        case 0xe4: m_zpg(); i_cpx(); break;
-        case 0xec: m_abs(); i_cpx(); break;
-
-        case 0xc0: m_imm(); i_cpy(); break;
-        case 0xc4: m_zpg(); i_cpy(); break;
-        case 0xcc: m_abs(); i_cpy(); break;
-
-        case 0xea: m_imp(); i_nop(); break;
-        case 0x00: m_imp(); i_brk(); break;
-        case 0x40: m_imp(); i_rti(); break;
-
-        case 0x04: m_zpg(); i_nop(); break;
-        case 0xe7: m_zpg(); i_isc(); break;
+    bool is_ppu_status(t_adr adr) {
+        return adr >= 0x2000u and adr < 0x4000u and (adr & 0x7u) == 0x2u;
+    }
 
-        default:
-            return -1;
+    // instructions that only read memory and leave the stack alone
+    bool is_spin_safe(const char* name) {
+        const char* names[] = {
+            "lda", "ldx", "ldy", "bit", "cmp", "cpx", "cpy", "and", "ora",
+            "eor", "nop", "tax", "tay", "txa", "tya", "clc", "sec", "clv"
+        };
+        for (auto x : names) {
+            if (std::strcmp(name, x) == 0) {
+                return true;
+            }
         }
+        return false;
+    }
 
-        step_count++;
+}
 
-        return 0;
+template <>
+struct t_machine::t_operand_of<t_machine::m_imp> {
+    using type = t_no_operand;
+};
+
+template <>
+struct t_machine::t_operand_of<t_machine::m_acc> {
+    using type = t_acc_operand;
+};
+
+template <>
+struct t_machine::t_operand_of<t_machine::m_imm> {
+    using type = t_value_operand;
+};
+
+template <>
+struct t_machine::t_operand_of<t_machine::m_rel> {
+    using type = t_value_operand;
+};
+
+void t_machine::process_interrupt() {
+    if (nmi_flag) {
+        // log_print_line("interrupt nmi");
+        nmi_flag = 0;
+        push_adr(pc);
+        auto val = get_status();
+        set_bit(val, 5, 1);
+        set_bit(val, 4, 0);
+        push(val);
+        set_interrupt_disable_flag(1);
+        pc = read_mem_2(0xfffa);
     }
+    if (reset_flag) {
+        // log_print_line("interrupt reset");
+        reset_flag = 0;
+        set_interrupt_disable_flag(1);
+        pc = read_mem_2(0xfffc);
+    } else if (irq_flag) {
+        // log_print_line("interrupt irq");
+        irq_flag = 0;
+        push_adr(pc);
+        auto val = get_status();
+        set_bit(val, 5, 1);
+        set_bit(val, 4, 0);
+        push(val);
+        set_interrupt_disable_flag(1);
+        pc = read_mem_2(0xfffe);
+    }
+}
 
-    void m_imp() {
-        r_cyc = 0;
-        w_cyc = 0;
-        set_arg(0, 0);
-
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str("\n");
+constexpr unsigned t_machine::get_mode_size(t_mode mode) {
+    switch (mode) {
+    case m_imp: case m_acc:
+        return 1;
+    case m_abs: case m_abx: case m_aby: case m_ind:
+        return 3;
+    default:
+        return 2;
     }
+}
 
-    void m_acc() {
-        r_cyc = 0;
-        w_cyc = 0;
-        set_arg(adr_ra, 0);
+t_adr t_machine::add_index(t_adr adr, char idx, bool& crossed) {
+    char lo = adr;
+    char hi = adr >> 8;
+    add_with_carry(lo, idx, crossed);
+    hi += crossed;
+    return make_adr(hi, lo);
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" a");
-        // log_print_str("\n");
+// maps the operand bytes of an instruction to the address it works on,
+// pc already points past the instruction
+template <t_machine::t_mode mode>
+t_adr t_machine::resolve_adr(t_adr operand, bool& crossed) {
+    switch (mode) {
+    case m_zpx:
+        return char(operand + rx);
+    case m_zpy:
+        return char(operand + ry);
+    case m_abx:
+        return add_index(operand, rx, crossed);
+    case m_aby:
+        return add_index(operand, ry, crossed);
+    case m_ind:
+        return read_mem_2(operand);
+    case m_inx:
+        return read_mem_2(char(operand + rx));
+    case m_iny:
+        return add_index(read_zpg_2(operand), ry, crossed);
+    default:
+        return operand;
     }
+}
 
-    void m_imm() {
-        r_cyc = 0;
-        w_cyc = 0;
-        set_arg(pc, 1);
+template <t_machine::t_mode mode>
+t_machine::t_mode_operand<mode> t_machine::resolve(t_adr operand,
+        bool& crossed) {
+    return { this, resolve_adr<mode>(operand, crossed) };
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" #$");
-        // log_print_hex(read_mem(pc), 2);
-        // log_print_str("\n");
-    }
+template <>
+t_machine::t_no_operand t_machine::resolve<t_machine::m_imp>(t_adr, bool&) {
+    return {};
+}
 
-    void m_rel() {
-        auto old_pc = pc;
-        set_arg(pc, 1);
-        r_cyc = 0;
-        w_cyc = 0;
+template <>
+t_machine::t_acc_operand t_machine::resolve<t_machine::m_acc>(t_adr,
+        bool&) {
+    return { this };
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(add_signed_offset(pc, read_mem(old_pc)), 4);
-        // log_print_str("\n");
-    }
+template <>
+t_machine::t_value_operand t_machine::resolve<t_machine::m_imm>(
+        t_adr operand, bool&) {
+    return { char(operand) };
+}
 
-    void m_zpg() {
-        r_cyc = 1;
-        w_cyc = 1;
-        set_arg(read_mem(pc), 1);
+template <>
+t_machine::t_value_operand t_machine::resolve<t_machine::m_rel>(
+        t_adr operand, bool&) {
+    return { char(operand) };
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(read_mem(pc), 2);
-        // log_print_str("\n");
-    }
+template <t_machine::t_mode mode,
+        void (t_machine::*instr)(t_machine::t_mode_operand<mode>)>
+bool t_machine::exec(t_machine& m, t_adr operand) {
+    auto crossed = false;
+    (m.*instr)(m.resolve<mode>(operand, crossed));
+    return crossed;
+}
 
-    void m_zpx() {
-        r_cyc = 2;
-        w_cyc = 2;
-        set_arg(char(read_mem(pc) + rx), 1);
+template <t_machine::t_mode mode,
+        void (t_machine::*instr)(t_machine::t_mode_operand<mode>)>
+constexpr t_machine::t_opcode t_machine::op(const char* name,
+        unsigned cycles, bool page_penalty) {
+    auto size = get_mode_size(mode);
+    return { name, exec<mode, instr>, mode, size, cycles, page_penalty };
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(read_mem(pc), 2);
-        // log_print_str(",x");
-        // log_print_str("\n");
-    }
+constexpr t_machine::t_opcode t_machine::op_xxx;
+
+// defined constexpr here rather than in the class, where the handlers it
+// points to can not be used in a constant expression yet
+constexpr std::array<t_machine::t_opcode, 0x100> t_machine::opcodes = {{
+    /* 0x00 */ op<m_imp, &t_machine::i_brk>("brk", 7),
+    /* 0x01 */ op<m_inx, &t_machine::i_ora>("ora", 6),
+    /* 0x02 */ op_xxx,
+    /* 0x03 */ op_xxx,
+    /* 0x04 */ op<m_zpg, &t_machine::i_nop>("nop", 3),
+    /* 0x05 */ op<m_zpg, &t_machine::i_ora>("ora", 3),
+    /* 0x06 */ op<m_zpg, &t_machine::i_asl>("asl", 5),
+    /* 0x07 */ op_xxx,
+    /* 0x08 */ op<m_imp, &t_machine::i_php>("php", 3),
+    /* 0x09 */ op<m_imm, &t_machine::i_ora>("ora", 2),
+    /* 0x0a */ op<m_acc, &t_machine::i_asl>("asl", 2),
+    /* 0x0b */ op_xxx,
+    /* 0x0c */ op_xxx,
+    /* 0x0d */ op<m_abs, &t_machine::i_ora>("ora", 4),
+    /* 0x0e */ op<m_abs, &t_machine::i_asl>("asl", 6),
+    /* 0x0f */ op_xxx,
+    /* 0x10 */ op<m_rel, &t_machine::i_bpl>("bpl", 2),
+    /* 0x11 */ op<m_iny, &t_machine::i_ora>("ora", 5, true),
+    /* 0x12 */ op_xxx,
+    /* 0x13 */ op_xxx,
+    /* 0x14 */ op_xxx,
+    /* 0x15 */ op<m_zpx, &t_machine::i_ora>("ora", 4),
+    /* 0x16 */ op<m_zpx, &t_machine::i_asl>("asl", 6),
+    /* 0x17 */ op_xxx,
+    /* 0x18 */ op<m_imp, &t_machine::i_clc>("clc", 2),
+    /* 0x19 */ op<m_aby, &t_machine::i_ora>("ora", 4, true),
+    /* 0x1a */ op_xxx,
+    /* 0x1b */ op_xxx,
+    /* 0x1c */ op_xxx,
+    /* 0x1d */ op<m_abx, &t_machine::i_ora>("ora", 4, true),
+    /* 0x1e */ op<m_abx, &t_machine::i_asl>("asl", 7),
+    /* 0x1f */ op_xxx,
+    /* 0x20 */ op<m_abs, &t_machine::i_jsr>("jsr", 6),
+    /* 0x21 */ op<m_inx, &t_machine::i_and>("and", 6),
+    /* 0x22 */ op_xxx,
+    /* 0x23 */ op_xxx,
+    /* 0x24 */ op<m_zpg, &t_machine::i_bit>("bit", 3),
+    /* 0x25 */ op<m_zpg, &t_machine::i_and>("and", 3),
+    /* 0x26 */ op<m_zpg, &t_machine::i_rol>("rol", 5),
+    /* 0x27 */ op_xxx,
+    /* 0x28 */ op<m_imp, &t_machine::i_plp>("plp", 4),
+    /* 0x29 */ op<m_imm, &t_machine::i_and>("and", 2),
+    /* 0x2a */ op<m_acc, &t_machine::i_rol>("rol", 2),
+    /* 0x2b */ op_xxx,
+    /* 0x2c */ op<m_abs, &t_machine::i_bit>("bit", 4),
+    /* 0x2d */ op<m_abs, &t_machine::i_and>("and", 4),
+    /* 0x2e */ op<m_abs, &t_machine::i_rol>("rol", 6),
+    /* 0x2f */ op_xxx,
+    /* 0x30 */ op<m_rel, &t_machine::i_bmi>("bmi", 2),
+    /* 0x31 */ op<m_iny, &t_machine::i_and>("and", 5, true),
+    /* 0x32 */ op_xxx,
+    /* 0x33 */ op_xxx,
+    /* 0x34 */ op_xxx,
+    /* 0x35 */ op<m_zpx, &t_machine::i_and>("and", 4),
+    /* 0x36 */ op<m_zpx, &t_machine::i_rol>("rol", 6),
+    /* 0x37 */ op_xxx,
+    /* 0x38 */ op<m_imp, &t_machine::i_sec>("sec", 2),
+    /* 0x39 */ op<m_aby, &t_machine::i_and>("and", 4, true),
+    /* 0x3a */ op_xxx,
+    /* 0x3b */ op_xxx,
+    /* 0x3c */ op_xxx,
+    /* 0x3d */ op<m_abx, &t_machine::i_and>("and", 4, true),
+    /* 0x3e */ op<m_abx, &t_machine::i_rol>("rol", 7),
+    /* 0x3f */ op_xxx,
+    /* 0x40 */ op<m_imp, &t_machine::i_rti>("rti", 6),
+    /* 0x41 */ op<m_inx, &t_machine::i_eor>("eor", 6),
+    /* 0x42 */ op_xxx,
+    /* 0x43 */ op_xxx,
+    /* 0x44 */ op_xxx,
+    /* 0x45 */ op<m_zpg, &t_machine::i_eor>("eor", 3),
+    /* 0x46 */ op<m_zpg, &t_machine::i_lsr>("lsr", 5),
+    /* 0x47 */ op_xxx,
+    /* 0x48 */ op<m_imp, &t_machine::i_pha>("pha", 3),
+    /* 0x49 */ op<m_imm, &t_machine::i_eor>("eor", 2),
+    /* 0x4a */ op<m_acc, &t_machine::i_lsr>("lsr", 2),
+    /* 0x4b */ op_xxx,
+    /* 0x4c */ op<m_abs, &t_machine::i_jmp>("jmp", 3),
+    /* 0x4d */ op<m_abs, &t_machine::i_eor>("eor", 4),
+    /* 0x4e */ op<m_abs, &t_machine::i_lsr>("lsr", 6),
+    /* 0x4f */ op_xxx,
+    /* 0x50 */ op<m_rel, &t_machine::i_bvc>("bvc", 2),
+    /* 0x51 */ op<m_iny, &t_machine::i_eor>("eor", 5, true),
+    /* 0x52 */ op_xxx,
+    /* 0x53 */ op_xxx,
+    /* 0x54 */ op_xxx,
+    /* 0x55 */ op<m_zpx, &t_machine::i_eor>("eor", 4),
+    /* 0x56 */ op<m_zpx, &t_machine::i_lsr>("lsr", 6),
+    /* 0x57 */ op_xxx,
+    /* 0x58 */ op<m_imp, &t_machine::i_cli>("cli", 2),
+    /* 0x59 */ op<m_aby, &t_machine::i_eor>("eor", 4, true),
+    /* 0x5a */ op_xxx,
+    /* 0x5b */ op_xxx,
+    /* 0x5c */ op_xxx,
+    /* 0x5d */ op<m_abx, &t_machine::i_eor>("eor", 4, true),
+    /* 0x5e */ op<m_abx, &t_machine::i_lsr>("lsr", 7),
+    /* 0x5f */ op_xxx,
+    /* 0x60 */ op<m_imp, &t_machine::i_rts>("rts", 6),
+    /* 0x61 */ op<m_inx, &t_machine::i_adc>("adc", 6),
+    /* 0x62 */ op_xxx,
+    /* 0x63 */ op_xxx,
+    /* 0x64 */ op_xxx,
+    /* 0x65 */ op<m_zpg, &t_machine::i_adc>("adc", 3),
+    /* 0x66 */ op<m_zpg, &t_machine::i_ror>("ror", 5),
+    /* 0x67 */ op_xxx,
+    /* 0x68 */ op<m_imp, &t_machine::i_pla>("pla", 4),
+    /* 0x69 */ op<m_imm, &t_machine::i_adc>("adc", 2),
+    /* 0x6a */ op<m_acc, &t_machine::i_ror>("ror", 2),
+    /* 0x6b */ op_xxx,
+    /* 0x6c */ op<m_ind, &t_machine::i_jmp>("jmp", 5),
+    /* 0x6d */ op<m_abs, &t_machine::i_adc>("adc", 4),
+    /* 0x6e */ op<m_abs, &t_machine::i_ror>("ror", 6),
+    /* 0x6f */ op_xxx,
+    /* 0x70 */ op<m_rel, &t_machine::i_bvs>("bvs", 2),
+    /* 0x71 */ op<m_iny, &t_machine::i_adc>("adc", 5, true),
+    /* 0x72 */ op_xxx,
+    /* 0x73 */ op_xxx,
+    /* 0x74 */ op_xxx,
+    /* 0x75 */ op<m_zpx, &t_machine::i_adc>("adc", 4),
+    /* 0x76 */ op<m_zpx, &t_machine::i_ror>("ror", 6),
+    /* 0x77 */ op_xxx,
+    /* 0x78 */ op<m_imp, &t_machine::i_sei>("sei", 2),
+    /* 0x79 */ op<m_aby, &t_machine::i_adc>("adc", 4, true),
+    /* 0x7a */ op_xxx,
+    /* 0x7b */ op_xxx,
+    /* 0x7c */ op_xxx,
+    /* 0x7d */ op<m_abx, &t_machine::i_adc>("adc", 4, true),
+    /* 0x7e */ op<m_abx, &t_machine::i_ror>("ror", 7),
+    /* 0x7f */ op_xxx,
+    /* 0x80 */ op_xxx,
+    /* 0x81 */ op<m_inx, &t_machine::i_sta>("sta", 6),
+    /* 0x82 */ op_xxx,
+    /* 0x83 */ op_xxx,
+    /* 0x84 */ op<m_zpg, &t_machine::i_sty>("sty", 3),
+    /* 0x85 */ op<m_zpg, &t_machine::i_sta>("sta", 3),
+    /* 0x86 */ op<m_zpg, &t_machine::i_stx>("stx", 3),
+    /* 0x87 */ op_xxx,
+    /* 0x88 */ op<m_imp, &t_machine::i_dey>("dey", 2),
+    /* 0x89 */ op_xxx,
+    /* 0x8a */ op<m_imp, &t_machine::i_txa>("txa", 2),
+    /* 0x8b */ op_xxx,
+    /* 0x8c */ op<m_abs, &t_machine::i_sty>("sty", 4),
+    /* 0x8d */ op<m_abs, &t_machine::i_sta>("sta", 4),
+    /* 0x8e */ op<m_abs, &t_machine::i_stx>("stx", 4),
+    /* 0x8f */ op_xxx,
+    /* 0x90 */ op<m_rel, &t_machine::i_bcc>("bcc", 2),
+    /* 0x91 */ op<m_iny, &t_machine::i_sta>("sta", 6),
+    /* 0x92 */ op_xxx,
+    /* 0x93 */ op_xxx,
+    /* 0x94 */ op<m_zpx, &t_machine::i_sty>("sty", 4),
+    /* 0x95 */ op<m_zpx, &t_machine::i_sta>("sta", 4),
+    /* 0x96 */ op<m_zpy, &t_machine::i_stx>("stx", 4),
+    /* 0x97 */ op_xxx,
+    /* 0x98 */ op<m_imp, &t_machine::i_tya>("tya", 2),
+    /* 0x99 */ op<m_aby, &t_machine::i_sta>("sta", 5),
+    /* 0x9a */ op<m_imp, &t_machine::i_txs>("txs", 2),
+    /* 0x9b */ op_xxx,
+    /* 0x9c */ op_xxx,
+    /* 0x9d */ op<m_abx, &t_machine::i_sta>("sta", 5),
+    /* 0x9e */ op_xxx,
+    /* 0x9f */ op_xxx,
+    /* 0xa0 */ op<m_imm, &t_machine::i_ldy>("ldy", 2),
+    /* 0xa1 */ op<m_inx, &t_machine::i_lda>("lda", 6),
+    /* 0xa2 */ op<m_imm, &t_machine::i_ldx>("ldx", 2),
+    /* 0xa3 */ op_xxx,
+    /* 0xa4 */ op<m_zpg, &t_machine::i_ldy>("ldy", 3),
+    /* 0xa5 */ op<m_zpg, &t_machine::i_lda>("lda", 3),
+    /* 0xa6 */ op<m_zpg, &t_machine::i_ldx>("ldx", 3),
+    /* 0xa7 */ op_xxx,
+    /* 0xa8 */ op<m_imp, &t_machine::i_tay>("tay", 2),
+    /* 0xa9 */ op<m_imm, &t_machine::i_lda>("lda", 2),
+    /* 0xaa */ op<m_imp, &t_machine::i_tax>("tax", 2),
+    /* 0xab */ op_xxx,
+    /* 0xac */ op<m_abs, &t_machine::i_ldy>("ldy", 4),
+    /* 0xad */ op<m_abs, &t_machine::i_lda>("lda", 4),
+    /* 0xae */ op<m_abs, &t_machine::i_ldx>("ldx", 4),
+    /* 0xaf */ op_xxx,
+    /* 0xb0 */ op<m_rel, &t_machine::i_bcs>("bcs", 2),
+    /* 0xb1 */ op<m_iny, &t_machine::i_lda>("lda", 5, true),
+    /* 0xb2 */ op_xxx,
+    /* 0xb3 */ op_xxx,
+    /* 0xb4 */ op<m_zpx, &t_machine::i_ldy>("ldy", 4),
+    /* 0xb5 */ op<m_zpx, &t_machine::i_lda>("lda", 4),
+    /* 0xb6 */ op<m_zpy, &t_machine::i_ldx>("ldx", 4),
+    /* 0xb7 */ op_xxx,
+    /* 0xb8 */ op<m_imp, &t_machine::i_clv>("clv", 2),
+    /* 0xb9 */ op<m_aby, &t_machine::i_lda>("lda", 4, true),
+    /* 0xba */ op<m_imp, &t_machine::i_tsx>("tsx", 2),
+    /* 0xbb */ op_xxx,
+    /* 0xbc */ op<m_abx, &t_machine::i_ldy>("ldy", 4, true),
+    /* 0xbd */ op<m_abx, &t_machine::i_lda>("lda", 4, true),
+    /* 0xbe */ op<m_aby, &t_machine::i_ldx>("ldx", 4, true),
+    /* 0xbf */ op_xxx,
+    /* 0xc0 */ op<m_imm, &t_machine::i_cpy>("cpy", 2),
+    /* 0xc1 */ op<m_inx, &t_machine::i_cmp>("cmp", 6),
+    /* 0xc2 */ op_xxx,
+    /* 0xc3 */ op_xxx,
+    /* 0xc4 */ op<m_zpg, &t_machine::i_cpy>("cpy", 3),
+    /* 0xc5 */ op<m_zpg, &t_machine::i_cmp>("cmp", 3),
+    /* 0xc6 */ op<m_zpg, &t_machine::i_dec>("dec", 5),
+    /* 0xc7 */ op_xxx,
+    /* 0xc8 */ op<m_imp, &t_machine::i_iny>("iny", 2),
+    /* 0xc9 */ op<m_imm, &t_machine::i_cmp>("cmp", 2),
+    /* 0xca */ op<m_imp, &t_machine::i_dex>("dex", 2),
+    /* 0xcb */ op_xxx,
+    /* 0xcc */ op<m_abs, &t_machine::i_cpy>("cpy", 4),
+    /* 0xcd */ op<m_abs, &t_machine::i_cmp>("cmp", 4),
+    /* 0xce */ op<m_abs, &t_machine::i_dec>("dec", 6),
+    /* 0xcf */ op_xxx,
+    /* 0xd0 */ op<m_rel, &t_machine::i_bne>("bne", 2),
+    /* 0xd1 */ op<m_iny, &t_machine::i_cmp>("cmp", 5, true),
+    /* 0xd2 */ op_xxx,
+    /* 0xd3 */ op_xxx,
+    /* 0xd4 */ op_xxx,
+    /* 0xd5 */ op<m_zpx, &t_machine::i_cmp>("cmp", 4),
+    /* 0xd6 */ op<m_zpx, &t_machine::i_dec>("dec", 6),
+    /* 0xd7 */ op_xxx,
+    /* 0xd8 */ op<m_imp, &t_machine::i_cld>("cld", 2),
+    /* 0xd9 */ op<m_aby, &t_machine::i_cmp>("cmp", 4, true),
+    /* 0xda */ op_xxx,
+    /* 0xdb */ op_xxx,
+    /* 0xdc */ op_xxx,
+    /* 0xdd */ op<m_abx, &t_machine::i_cmp>("cmp", 4, true),
+    /* 0xde */ op<m_abx, &t_machine::i_dec>("dec", 7),
+    /* 0xdf */ op_xxx,
+    /* 0xe0 */ op<m_imm, &t_machine::i_cpx>("cpx", 2),
+    /* 0xe1 */ op<m_inx, &t_machine::i_sbc>("sbc", 6),
+    /* 0xe2 */ op_xxx,
+    /* 0xe3 */ op_xxx,
+    /* 0xe4 */ op<m_zpg, &t_machine::i_cpx>("cpx", 3),
+    /* 0xe5 */ op<m_zpg, &t_machine::i_sbc>("sbc", 3),
+    /* 0xe6 */ op<m_zpg, &t_machine::i_inc>("inc", 5),
+    /* 0xe7 */ op<m_zpg, &t_machine::i_isc>("isc", 5),
+    /* 0xe8 */ op<m_imp, &t_machine::i_inx>("inx", 2),
+    /* 0xe9 */ op<m_imm, &t_machine::i_sbc>("sbc", 2),
+    /* 0xea */ op<m_imp, &t_machine::i_nop>("nop", 2),
+    /* 0xeb */ op_xxx,
+    /* 0xec */ op<m_abs, &t_machine::i_cpx>("cpx", 4),
+    /* 0xed */ op<m_abs, &t_machine::i_sbc>("sbc", 4),
+    /* 0xee */ op<m_abs, &t_machine::i_inc>("inc", 6),
+    /* 0xef */ op_xxx,
+    /* 0xf0 */ op<m_rel, &t_machine::i_beq>("beq", 2),
+    /* 0xf1 */ op<m_iny, &t_machine::i_sbc>("sbc", 5, true),
+    /* 0xf2 */ op_xxx,
+    /* 0xf3 */ op_xxx,
+    /* 0xf4 */ op_xxx,
+    /* 0xf5 */ op<m_zpx, &t_machine::i_sbc>("sbc", 4),
+    /* 0xf6 */ op<m_zpx, &t_machine::i_inc>("inc", 6),
+    /* 0xf7 */ op_xxx,
+    /* 0xf8 */ op<m_imp, &t_machine::i_sed>("sed", 2),
+    /* 0xf9 */ op<m_aby, &t_machine::i_sbc>("sbc", 4, true),
+    /* 0xfa */ op_xxx,
+    /* 0xfb */ op_xxx,
+    /* 0xfc */ op_xxx,
+    /* 0xfd */ op<m_abx, &t_machine::i_sbc>("sbc", 4, true),
+    /* 0xfe */ op<m_abx, &t_machine::i_inc>("inc", 7),
+    /* 0xff */ op_xxx
+}};
+
+t_machine::t_decoded t_machine::decode(t_adr adr) {
+    char opcode = read_mem(adr);
+    auto& info = opcodes[opcode];
+    t_adr operand = 0;
+    if (info.size == 2) {
+        operand = read_mem(adr + 1);
+    } else if (info.size == 3) {
+        operand = read_mem_2(adr + 1);
+    }
+    auto size = char(info.size);
+    auto cycles = char(info.cycles);
+    return { info.exec, operand, opcode, size, cycles, info.page_penalty };
+}
 
-    void m_zpy() {
-        r_cyc = 2;
-        w_cyc = 2;
-        set_arg(char(read_mem(pc) + ry), 1);
+const t_machine::t_block& t_machine::get_block(t_adr adr) {
+    auto& block = block_cache[adr - prg_rom_start];
+    if (block.empty()) {
+        if (block_pool.size() + max_block_length > block_pool.capacity()) {
+            clear_block_cache();
+        }
+        auto first = block_pool.data() + block_pool.size();
+        auto length = 0u;
+        while (adr < 0x10000u and length < max_block_length) {
+            auto instr = decode(adr);
+            if (instr.exec == nullptr) {
+                break;
+            }
+            block_pool.push_back(instr);
+            length++;
+            adr += instr.size;
+            if (ends_block(instr.opcode)) {
+                break;
+            }
+        }
+        block = { first, length };
+    }
+    return block;
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(read_mem(pc), 2);
-        // log_print_str(",y");
-        // log_print_str("\n");
+// continues the current block while control flows straight through it,
+// code outside prg rom is not cached
+const t_machine::t_decoded* t_machine::fetch_cached(t_adr adr) {
+    if (adr < prg_rom_start or adr >= 0x10000u) {
+        return nullptr;
+    }
+    auto in_block = cur_block != nullptr and adr == cur_block_pc;
+    if (not in_block or cur_block_idx == cur_block->size()) {
+        cur_block = &get_block(adr);
+        cur_block_idx = 0;
+        if (cur_block->empty()) {
+            cur_block = nullptr;
+            return nullptr;
+        }
     }
+    auto instr = &(*cur_block)[cur_block_idx];
+    cur_block_idx++;
+    cur_block_pc = adr + instr->size;
+    return instr;
+}
+
+void t_machine::clear_block_cache() {
+    std::fill(block_cache.begin(), block_cache.end(), t_block{ nullptr, 0 });
+    block_pool.clear();
+    cur_block = nullptr;
+}
 
-    void m_abs() {
-        r_cyc = 2;
-        w_cyc = 2;
-        set_arg(read_mem_2(pc), 2);
+int t_machine::execute() {
+    // log_print_str("a "); log_print_hex(ra, 2);
+    // log_print_str(" | x "); log_print_hex(rx, 2);
+    // log_print_str(" | y "); log_print_hex(ry, 2);
+    // log_print_str(" | p "); log_print_hex(rp, 2);
+    // log_print_str(" | sp "); log_print_hex(sp, 2);
+    // log_print_str(" | ");
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(read_mem_2(pc), 4);
-        // log_print_str("\n");
+    // log_print_hex(pc, 4);
+
+    // fetch an instruction
+    auto instr = fetch_cached(pc);
+    t_decoded uncached;
+    if (instr == nullptr) {
+        uncached = decode(pc);
+        instr = &uncached;
     }
+    cur_opcode = instr->opcode;
+
+    // log_print_str("  ");
+    // log_set_width(10);
+    // log_print_hex(cur_opcode, 2);
 
-    void m_abx() {
-        auto lo = read_mem(pc);
-        auto hi = read_mem(pc + 1);
-        bool carry;
-        add_with_carry(lo, rx, carry);
-        hi += carry;
-        set_arg(make_adr(hi, lo), 2);
-        r_cyc = 2 + carry;
-        w_cyc = 3;
-
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(read_mem_2(pc), 4);
-        // log_print_str(",x");
-        // log_print_str("\n");
+    if (instr->exec == nullptr) {
+        return -1;
     }
+    pc += instr->size;
 
-    void m_aby() {
-        auto lo = read_mem(pc);
-        auto hi = read_mem(pc + 1);
-        bool carry;
-        add_with_carry(lo, ry, carry);
-        hi += carry;
-        set_arg(make_adr(hi, lo), 2);
-        r_cyc = 2 + carry;
-        w_cyc = 3;
-
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" $");
-        // log_print_hex(read_mem_2(pc), 4);
-        // log_print_str(",y");
-        // log_print_str("\n");
+    // execute the given instruction
+    auto crossed = instr->exec(*this, instr->operand);
+    cycle_count += instr->cycles;
+    if (instr->page_penalty and crossed) {
+        cycle_count++;
     }
 
-    void m_ind() {
-        set_arg(read_mem_2(read_mem_2(pc)), 2);
-        r_cyc = 4;
+    step_count++;
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" ($");
-        // log_print_hex(read_mem_2(pc), 4);
-        // log_print_str(")");
-        // log_print_str("\n");
+    return 0;
+}
+
+// only instructions that touch nothing but ram and prg rom are translated, so
+// running ahead of the ppu inside a block can not be observed as long as it
+// ends before the ppu may raise an nmi
+bool t_machine::is_bus_safe(const t_decoded& instr) {
+    auto adr = instr.operand;
+    switch (opcodes[instr.opcode].mode) {
+    case m_imp: case m_acc: case m_imm: case m_rel:
+    case m_zpg: case m_zpx: case m_zpy:
+        return true;
+    case m_abs:
+        return is_plain_memory(adr, adr);
+    case m_ind:
+        return is_plain_memory(adr, adr + 1);
+    case m_abx: case m_aby:
+        return is_plain_memory(adr, adr + 0xff);
+    default:
+        return false;
     }
+}
 
-    void m_inx() {
-        r_cyc = 4;
-        w_cyc = 4;
-        set_arg(read_mem_2(char(read_mem(pc) + rx)), 1);
+jit::t_block t_machine::translate(t_adr adr) {
+    auto& instrs = jit_instrs;
+    instrs.clear();
+    for (auto& instr : get_block(adr)) {
+        if (not is_bus_safe(instr)) {
+            break;
+        }
+        adr += instr.size;
+        auto cycles = unsigned(instr.cycles);
+        auto branch = opcodes[instr.opcode].mode == m_rel;
+        instrs.push_back({ instr.exec, instr.operand, adr, cycles,
+                instr.page_penalty, branch });
+    }
+    if (instrs.size() < min_jit_length) {
+        return nullptr;
+    }
+    jit::t_state st = { this, &cycle_count, &pc, &step_count };
+    auto fn = jit_arena.compile(instrs, st);
+    if (fn == nullptr and jit_arena.is_full()) {
+        // starts over with an empty arena, the blocks that are still hot
+        // are translated again once entered often enough
+        clear_jit_cache();
+        fn = jit_arena.compile(instrs, st);
+    }
+    return fn;
+}
 
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" ($");
-        // log_print_hex(read_mem(pc), 2);
-        // log_print_str(",x)");
-        // log_print_str("\n");
+jit::t_block t_machine::get_jit_block(t_adr adr) {
+    if (adr < prg_rom_start or adr >= 0x10000u) {
+        return nullptr;
     }
-
-    void m_iny() {
-        auto adr = read_mem(pc);
-        auto lo = read_mem(adr);
-        adr++;
-        auto hi = read_mem(adr);
-        bool carry;
-        add_with_carry(lo, ry, carry);
-        hi += carry;
-        set_arg(make_adr(hi, lo), 1);
-        r_cyc = 3 + carry;
-        w_cyc = 4;
-
-        // log_print_str(get_opcode_str(cur_opcode));
-        // log_print_str(" ($");
-        // log_print_hex(read_mem(pc), 2);
-        // log_print_str("),y");
-        // log_print_str("\n");
+    auto& entry = jit_cache[adr - prg_rom_start];
+    if (entry.fn == nullptr and entry.hits < jit_threshold) {
+        entry.hits++;
+        if (entry.hits == jit_threshold) {
+            entry.fn = translate(adr);
+        }
     }
+    return entry.fn;
+}
 
-    void i_lda() {
-        auto res = read_mem(arg);
-        set_with_flags(adr_ra, res);
-        cycle_count += 2 + r_cyc;
-    }
+void t_machine::clear_jit_cache() {
+    std::fill(jit_cache.begin(), jit_cache.end(), t_jit_entry{});
+    jit_arena.reset();
+}
 
-    void i_ldx() {
-        set_with_flags(adr_rx, read_mem(arg));
-        cycle_count += 2 + r_cyc;
-    }
+t_machine::t_cpu_state t_machine::save_state() {
+    auto rp = get_status();
+    return { memory, pc, sp, ra, rx, ry, rp, cycle_count, step_count };
+}
 
-    void i_ldy() {
-        set_with_flags(adr_ry, read_mem(arg));
-        cycle_count += 2 + r_cyc;
-    }
+void t_machine::load_state(const t_cpu_state& st) {
+    memory = st.memory;
+    pc = st.pc;
+    sp = st.sp;
+    ra = st.ra;
+    rx = st.rx;
+    ry = st.ry;
+    set_status(st.rp);
+    cycle_count = st.cycle_count;
+    step_count = st.step_count;
+}
 
-    void i_sta() {
-        cycle_count += 2 + w_cyc;
-        write_mem(arg, ra);
-    }
+bool t_machine::same_state(const t_cpu_state& a, const t_cpu_state& b) {
+    return a.memory == b.memory and a.pc == b.pc and a.sp == b.sp
+        and a.ra == b.ra and a.rx == b.rx and a.ry == b.ry
+        and a.rp == b.rp and a.cycle_count == b.cycle_count
+        and a.step_count == b.step_count;
+}
 
-    void i_stx() {
-        cycle_count += 2 + r_cyc;
-        write_mem(arg, rx);
-    }
+void t_machine::print_state(const char* name, const t_cpu_state& st) {
+    std::cout.flush();
+    printf("%s | a : $%02x | x : $%02x | y : $%02x | sp : $%02x", name,
+            st.ra, st.rx, st.ry, st.sp);
+    printf(" | pc : $%04lx | p : $%02x | cc : %lu | sc : %lu |\n", st.pc,
+            st.rp, st.cycle_count, st.step_count);
+    std::fflush(stdout);
+}
 
-    void i_sty() {
-        cycle_count += 2 + r_cyc;
-        write_mem(arg, ry);
+void t_machine::run_jit_block(jit::t_block fn) {
+    auto budget = (nmi_deadline - pending_dots) / 3;
+    if (not jit_verify) {
+        fn(budget);
+        return;
+    }
+    auto start_pc = pc;
+    auto before = save_state();
+    fn(budget);
+    auto after_jit = save_state();
+    load_state(before);
+    while (step_count < after_jit.step_count) {
+        execute();
+    }
+    auto after_interpreter = save_state();
+    if (not same_state(after_jit, after_interpreter)) {
+        std::cout.flush();
+        printf("jit mismatch in block at $%04lx\n", start_pc);
+        print_state("jit        ", after_jit);
+        print_state("interpreter", after_interpreter);
+        exit(1);
     }
+}
 
-    void i_tax() {
-        set_with_flags(adr_rx, ra);
-        cycle_count += 2;
+t_machine::t_spin_info t_machine::analyze_spin(t_adr head) {
+    t_spin_info res = { true, false, false, 0, 0 };
+    auto adr = head;
+    for (auto& instr : get_block(head)) {
+        if (res.length == max_spin_length) {
+            break;
+        }
+        auto& info = opcodes[instr.opcode];
+        adr += instr.size;
+        res.length++;
+        if (info.mode == m_rel) {
+            auto target = add_signed_offset(adr, instr.operand);
+            if (target == head) {
+                auto crossed = (adr >> 8) != (target >> 8);
+                res.cycles += info.cycles + 1 + crossed;
+                res.idle = true;
+            }
+            break;
+        }
+        if (instr.opcode == char(0x4c)) {
+            if (instr.operand == head) {
+                res.cycles += info.cycles;
+                res.idle = true;
+            }
+            break;
+        }
+        if (not is_spin_safe(info.name)) {
+            break;
+        }
+        if (info.mode == m_abs) {
+            if (is_ppu_status(instr.operand)) {
+                res.reads_status = true;
+            } else if (not is_plain_memory(instr.operand, instr.operand)) {
+                break;
+            }
+        } else if (info.mode != m_imp and info.mode != m_imm
+                and info.mode != m_zpg) {
+            break;
+        }
+        res.cycles += info.cycles;
     }
+    return res;
+}
 
-    void i_tay() {
-        set_with_flags(adr_ry, ra);
-        cycle_count += 2;
+const t_machine::t_spin_info& t_machine::get_spin_info(t_adr adr) {
+    auto& info = spin_cache[adr - prg_rom_start];
+    if (not info.analyzed) {
+        info = analyze_spin(adr);
     }
+    return info;
+}
 
-    void i_txa() {
-        set_with_flags(adr_ra, rx);
-        cycle_count += 2;
-    }
+void t_machine::clear_spin_cache() {
+    std::fill(spin_cache.begin(), spin_cache.end(), t_spin_info{});
+    last_spin = {};
+}
 
-    void i_tya() {
-        set_with_flags(adr_ra, ry);
-        cycle_count += 2;
-    }
+// called when control has just gone back to pc, if it is the head of an
+// idle loop and the previous iteration left the registers as they were,
+// the iterations that start before anything they read can change are
+// skipped by only counting their cycles and steps
+void t_machine::skip_idle_loop() {
+    if (pc < prg_rom_start or pc >= 0x10000u or nmi_flag or irq_flag) {
+        return;
+    }
+    auto& info = get_spin_info(pc);
+    if (not info.idle) {
+        return;
+    }
+    auto prev = last_spin;
+    last_spin = { pc, step_count, ra, rx, ry, sp, get_status() };
+    auto repeated = prev.head == pc
+        and prev.step_count + info.length == step_count
+        and prev.ra == ra and prev.rx == rx and prev.ry == ry
+        and prev.sp == sp and prev.rp == last_spin.rp;
+    if (not repeated) {
+        return;
+    }
+    if (info.reads_status and ppu_thread.is_running()) {
+        sync_ppu();
+    }
+    auto deadline = nmi_deadline;
+    if (info.reads_status) {
+        auto status = ppu.get_dots_until_event(t_ppu::event_status);
+        deadline = std::min(deadline, status);
+    }
+    if (deadline <= pending_dots) {
+        return;
+    }
+    auto n = (deadline - pending_dots - 1) / (3 * info.cycles);
+    cycle_count += n * info.cycles;
+    step_count += n * info.length;
+    last_spin.step_count = step_count;
+}
 
-    void i_tsx() {
-        set_with_flags(adr_rx, sp);
-        cycle_count += 2;
-    }
+int t_machine::step() {
+    // getchar();
 
-    void i_txs() {
-        sp = rx;
-        cycle_count += 2;
+    auto idf = get_interrupt_disable_flag();
+    if (nmi_flag or reset_flag or (not idf and irq_flag)) {
+        process_interrupt();
+        cycle_count = 6;
+        return 0;
     }
 
-    void i_pha() {
-        push(ra);
-        cycle_count += 3;
-    }
+    auto start_pc = pc;
 
-    void i_pla() {
-        set_with_flags(adr_ra, pull());
-        cycle_count += 4;
+    if (jit_enabled) {
+        auto fn = get_jit_block(pc);
+        if (fn != nullptr) {
+            run_jit_block(fn);
+            if (pc <= start_pc) {
+                skip_idle_loop();
+            }
+            return 0;
+        }
     }
 
-    void i_php() {
-        auto val = rp;
-        set_bit(val, 5, 1);
-        set_bit(val, 4, 1);
-        push(val);
-        cycle_count += 3;
+    auto ret = execute();
+    if (ret == 0 and pc <= start_pc) {
+        skip_idle_loop();
     }
+    return ret;
+}
 
-    void i_plp() {
-        rp = pull();
-        cycle_count += 4;
-    }
+template <class t_operand>
+void t_machine::i_lda(t_operand o) {
+    set_with_flags(ra, o.get());
+}
 
-    void i_and() {
-        set_with_flags(adr_ra, ra & read_mem(arg));
-        cycle_count += 2 + r_cyc;
-    }
+template <class t_operand>
+void t_machine::i_ldx(t_operand o) {
+    set_with_flags(rx, o.get());
+}
 
-    void i_eor() {
-        set_with_flags(adr_ra, ra ^ read_mem(arg));
-        cycle_count += 2 + r_cyc;
-    }
+template <class t_operand>
+void t_machine::i_ldy(t_operand o) {
+    set_with_flags(ry, o.get());
+}
 
-    void i_ora() {
-        set_with_flags(adr_ra, ra | read_mem(arg));
-        cycle_count += 2 + r_cyc;
-    }
+void t_machine::i_sta(t_mem_operand o) {
+    o.set(ra);
+}
 
-    void i_bit() {
-        auto val = read_mem(arg);
-        set_zero_flag((ra & val) == 0);
-        set_overflow_flag(get_bit(val, 6));
-        set_negative_flag(get_bit(val, 7));
-        cycle_count += 2 + r_cyc;
-    };
-
-    void i_inc() {
-        set_with_flags(arg, read_mem(arg) + 1);
-        cycle_count += 4 + w_cyc;
-    }
+void t_machine::i_stx(t_mem_operand o) {
+    o.set(rx);
+}
 
-    void i_dec() {
-        set_with_flags(arg, read_mem(arg) - 1);
-        cycle_count += 4 + w_cyc;
-    }
+void t_machine::i_sty(t_mem_operand o) {
+    o.set(ry);
+}
 
-    void i_inx() {
-        set_with_flags(adr_rx, rx + 1);
-        cycle_count += 2;
-    }
+void t_machine::i_tax(t_no_operand) {
+    set_with_flags(rx, ra);
+}
 
-    void i_dex() {
-        set_with_flags(adr_rx, rx - 1);
-        cycle_count += 2;
-    }
+void t_machine::i_tay(t_no_operand) {
+    set_with_flags(ry, ra);
+}
 
-    void i_iny() {
-        set_with_flags(adr_ry, ry + 1);
-        cycle_count += 2;
-    }
+void t_machine::i_txa(t_no_operand) {
+    set_with_flags(ra, rx);
+}
 
-    void i_dey() {
-        set_with_flags(adr_ry, ry - 1);
-        cycle_count += 2;
-    }
+void t_machine::i_tya(t_no_operand) {
+    set_with_flags(ra, ry);
+}
 
-    void i_jmp() {
-        pc = arg;
-        cycle_count += 1 + r_cyc;
-    }
+void t_machine::i_tsx(t_no_operand) {
+    set_with_flags(rx, sp);
+}
 
-    void i_jsr() {
-        push_adr(pc - 1);
-        pc = arg;
-        cycle_count += 4 + r_cyc;
-    }
+void t_machine::i_txs(t_no_operand) {
+    sp = rx;
+}
 
-    void i_rts() {
-        pc = pull_adr() + 1;
-        cycle_count += 6;
-    }
+void t_machine::i_pha(t_no_operand) {
+    push(ra);
+}
 
-    void i_clc() {
-        set_carry_flag(0);
-        cycle_count += 2;
-    }
+void t_machine::i_pla(t_no_operand) {
+    set_with_flags(ra, pull());
+}
 
-    void i_sec() {
-        set_carry_flag(1);
-        cycle_count += 2;
-    }
+void t_machine::i_php(t_no_operand) {
+    auto val = get_status();
+    set_bit(val, 5, 1);
+    set_bit(val, 4, 1);
+    push(val);
+}
 
-    void i_clv() {
-        set_overflow_flag(0);
-        cycle_count += 2;
-    }
+void t_machine::i_plp(t_no_operand) {
+    set_status(pull());
+}
 
-    void i_cld() {
-        set_bit(rp, 3, 0);
-        cycle_count += 2;
-    }
+template <class t_operand>
+void t_machine::i_and(t_operand o) {
+    set_with_flags(ra, ra & o.get());
+}
 
-    void i_sed() {
-        set_bit(rp, 3, 1);
-        cycle_count += 2;
-    }
+template <class t_operand>
+void t_machine::i_eor(t_operand o) {
+    set_with_flags(ra, ra ^ o.get());
+}
 
-    void i_cli() {
-        set_bit(rp, 2, 0);
-        cycle_count += 2;
-    }
+template <class t_operand>
+void t_machine::i_ora(t_operand o) {
+    set_with_flags(ra, ra | o.get());
+}
 
-    void i_sei() {
-        set_bit(rp, 2, 1);
-        cycle_count += 2;
-    }
+void t_machine::i_bit(t_mem_operand o) {
+    auto val = o.get();
+    z_result = ra & val;
+    n_result = val;
+    set_overflow_flag(val & 0x40u);
+}
 
-    void i_bcc() {
-        short_jump_if(get_carry_flag() == 0);
-    }
+void t_machine::i_inc(t_mem_operand o) {
+    set_with_flags(o, o.get() + 1);
+}
 
-    void i_bcs() {
-        short_jump_if(get_carry_flag() == 1);
-    }
+void t_machine::i_dec(t_mem_operand o) {
+    set_with_flags(o, o.get() - 1);
+}
 
-    void i_bpl() {
-        short_jump_if(get_negative_flag() == 0);
-    }
+void t_machine::i_inx(t_no_operand) {
+    set_with_flags(rx, rx + 1);
+}
 
-    void i_bmi() {
-        short_jump_if(get_negative_flag() == 1);
-    }
+void t_machine::i_dex(t_no_operand) {
+    set_with_flags(rx, rx - 1);
+}
 
-    void i_bne() {
-        short_jump_if(get_zero_flag() == 0);
-    }
+void t_machine::i_iny(t_no_operand) {
+    set_with_flags(ry, ry + 1);
+}
 
-    void i_beq() {
-        short_jump_if(get_zero_flag() == 1);
-    }
+void t_machine::i_dey(t_no_operand) {
+    set_with_flags(ry, ry - 1);
+}
 
-    void i_bvc() {
-        short_jump_if(get_overflow_flag() == 0);
-    }
+void t_machine::i_jmp(t_mem_operand o) {
+    pc = o.adr;
+}
 
-    void i_bvs() {
-        short_jump_if(get_overflow_flag() == 1);
-    }
+void t_machine::i_jsr(t_mem_operand o) {
+    push_adr(pc - 1);
+    pc = o.adr;
+}
 
-    void i_brk() {
-        push_adr(pc + 1);
-        auto val = rp;
-        set_bit(val, 5, 1);
-        set_bit(val, 4, 1);
-        push(val);
-        pc = read_mem_2(0xfffe);
-        set_break_flag(1);
-        set_interrupt_disable_flag(1);
-        cycle_count += 7;
-    }
+void t_machine::i_rts(t_no_operand) {
+    pc = pull_adr() + 1;
+}
 
-    void i_rti() {
-        rp = pull();
-        pc = pull_adr();
-        cycle_count += 6;
-    }
+void t_machine::i_clc(t_no_operand) {
+    set_carry_flag(0);
+}
 
-    void i_nop() {
-        cycle_count += 2 + r_cyc;
-    }
+void t_machine::i_sec(t_no_operand) {
+    set_carry_flag(1);
+}
 
-    void i_asl() {
-        auto val = read_mem(arg);
-        set_carry_flag(get_bit(val, 7));
-        set_with_flags(arg, val << 1);
-        cycle_count += (arg == adr_ra) ? 2 : (4 + w_cyc);
-    }
+void t_machine::i_clv(t_no_operand) {
+    set_overflow_flag(0);
+}
 
-    void i_lsr() {
-        auto val = read_mem(arg);
-        set_carry_flag(get_bit(val, 0));
-        set_with_flags(arg, val >> 1);
-        cycle_count += (arg == adr_ra) ? 2 : (4 + w_cyc);
-    }
+void t_machine::i_cld(t_no_operand) {
+    set_bit(rp, 3, 0);
+}
 
-    void i_rol() {
-        auto val = read_mem(arg);
-        auto ca = get_carry_flag();
-        set_carry_flag(get_bit(val, 7));
-        val <<= 1;
-        set_bit(val, 0, ca);
-        set_with_flags(arg, val);
-        cycle_count += (arg == adr_ra) ? 2 : (4 + w_cyc);
-    }
+void t_machine::i_sed(t_no_operand) {
+    set_bit(rp, 3, 1);
+}
 
-    void i_ror() {
-        auto val = read_mem(arg);
-        auto ca = get_carry_flag();
-        set_carry_flag(get_bit(val, 0));
-        val >>= 1;
-        set_bit(val, 7, ca);
-        set_with_flags(arg, val);
-        cycle_count += (arg == adr_ra) ? 2 : (4 + w_cyc);
-    }
+void t_machine::i_cli(t_no_operand) {
+    set_bit(rp, 2, 0);
+}
 
-    void i_adc() {
-        unsigned res = ra;
-        unsigned v = read_mem(arg);
-        auto ca = get_carry_flag();
-        v += ca;
-        auto a7 = get_bit(ra, 7);
-        auto b7 = get_bit(v, 7);
-        res += v;
-        set_with_flags(adr_ra, res);
-        auto c7 = get_bit(ra, 7);
-        if (ca == 1 and v == 0x80u) {
-            set_overflow_flag(a7 == 0);
-        } else {
-            set_overflow_flag(a7 == b7 and a7 != c7);
-        }
-        set_carry_flag(res >= 0x100u);
-        cycle_count += 2 + r_cyc;
-    }
+void t_machine::i_sei(t_no_operand) {
+    set_bit(rp, 2, 1);
+}
 
-    void i_sbc() {
-        unsigned res = ra;
-        unsigned xx = read_mem(arg);
-        auto nc = !get_carry_flag();
-        xx += nc;
-        auto a7 = get_bit(ra, 7);
-        auto b7 = get_bit(xx, 7);
-        res -= xx;
-        set_with_flags(adr_ra, res);
-        auto c7 = get_bit(ra, 7);
-        if (nc == 1 and xx == 0x80u) {
-            set_overflow_flag(a7 == 1);
-        } else {
-            set_overflow_flag(a7 != b7 and b7 == c7);
-        }
-        set_carry_flag(res < 0x100);
-        cycle_count += 2 + r_cyc;
-    }
+void t_machine::i_bcc(t_value_operand o) {
+    short_jump_if(o.get(), get_carry_flag() == 0);
+}
+
+void t_machine::i_bcs(t_value_operand o) {
+    short_jump_if(o.get(), get_carry_flag() == 1);
+}
+
+void t_machine::i_bpl(t_value_operand o) {
+    short_jump_if(o.get(), get_negative_flag() == 0);
+}
+
+void t_machine::i_bmi(t_value_operand o) {
+    short_jump_if(o.get(), get_negative_flag() == 1);
+}
+
+void t_machine::i_bne(t_value_operand o) {
+    short_jump_if(o.get(), get_zero_flag() == 0);
+}
+
+void t_machine::i_beq(t_value_operand o) {
+    short_jump_if(o.get(), get_zero_flag() == 1);
+}
+
+void t_machine::i_bvc(t_value_operand o) {
+    short_jump_if(o.get(), get_overflow_flag() == 0);
+}
+
+void t_machine::i_bvs(t_value_operand o) {
+    short_jump_if(o.get(), get_overflow_flag() == 1);
+}
+
+void t_machine::i_brk(t_no_operand) {
+    push_adr(pc + 1);
+    auto val = get_status();
+    set_bit(val, 5, 1);
+    set_bit(val, 4, 1);
+    push(val);
+    pc = read_mem_2(0xfffe);
+    set_break_flag(1);
+    set_interrupt_disable_flag(1);
+}
+
+void t_machine::i_rti(t_no_operand) {
+    set_status(pull());
+    pc = pull_adr();
+}
+
+template <class t_operand>
+void t_machine::i_nop(t_operand) {
+}
+
+template <class t_operand>
+void t_machine::i_asl(t_operand o) {
+    auto val = o.get();
+    set_carry_flag(get_bit(val, 7));
+    set_with_flags(o, val << 1);
+}
 
-    void i_cmp() {
-        auto val = read_mem(arg);
-        set_carry_flag(ra >= val);
-        set_zero_flag(ra == val);
-        set_negative_flag(get_bit(ra - val, 7));
-        cycle_count += 2 + r_cyc;
+template <class t_operand>
+void t_machine::i_lsr(t_operand o) {
+    auto val = o.get();
+    set_carry_flag(get_bit(val, 0));
+    set_with_flags(o, val >> 1);
+}
+
+template <class t_operand>
+void t_machine::i_rol(t_operand o) {
+    auto val = o.get();
+    auto ca = get_carry_flag();
+    set_carry_flag(get_bit(val, 7));
+    val <<= 1;
+    set_bit(val, 0, ca);
+    set_with_flags(o, val);
+}
+
+template <class t_operand>
+void t_machine::i_ror(t_operand o) {
+    auto val = o.get();
+    auto ca = get_carry_flag();
+    set_carry_flag(get_bit(val, 0));
+    val >>= 1;
+    set_bit(val, 7, ca);
+    set_with_flags(o, val);
+}
+
+template <class t_operand>
+void t_machine::i_adc(t_operand o) {
+    unsigned res = ra;
+    unsigned v = o.get();
+    auto ca = get_carry_flag();
+    v += ca;
+    auto a7 = get_bit(ra, 7);
+    auto b7 = get_bit(v, 7);
+    res += v;
+    set_with_flags(ra, res);
+    auto c7 = get_bit(ra, 7);
+    if (ca == 1 and v == 0x80u) {
+        set_overflow_flag(a7 == 0);
+    } else {
+        set_overflow_flag(a7 == b7 and a7 != c7);
+    }
+    set_carry_flag(res >= 0x100u);
+}
+
+template <class t_operand>
+void t_machine::i_sbc(t_operand o) {
+    unsigned res = ra;
+    unsigned xx = o.get();
+    auto nc = !get_carry_flag();
+    xx += nc;
+    auto a7 = get_bit(ra, 7);
+    auto b7 = get_bit(xx, 7);
+    res -= xx;
+    set_with_flags(ra, res);
+    auto c7 = get_bit(ra, 7);
+    if (nc == 1 and xx == 0x80u) {
+        set_overflow_flag(a7 == 1);
+    } else {
+        set_overflow_flag(a7 != b7 and b7 == c7);
+    }
+    set_carry_flag(res < 0x100);
+}
+
+void t_machine::compare(char reg, char val) {
+    set_carry_flag(reg >= val);
+    set_result_flags(reg - val);
+}
+
+template <class t_operand>
+void t_machine::i_cmp(t_operand o) {
+    compare(ra, o.get());
+}
+
+template <class t_operand>
+void t_machine::i_cpx(t_operand o) {
+    compare(rx, o.get());
+}
+
+template <class t_operand>
+void t_machine::i_cpy(t_operand o) {
+    compare(ry, o.get());
+}
+
+void t_machine::i_isc(t_mem_operand o) {
+    i_inc(o);
+    i_sbc(o);
+}
+
+char t_machine::read_mem(t_adr adr) {
+    auto& page = pages[(adr >> 8) & 0xffu];
+    if (page.read_ptr != nullptr) {
+        return page.read_ptr[adr & 0xffu];
     }
+    return (this->*page.read)(adr);
+}
 
-    void i_cpx() {
-        auto val = read_mem(arg);
-        set_carry_flag(rx >= val);
-        set_zero_flag(rx == val);
-        set_negative_flag(get_bit(rx - val, 7));
-        cycle_count += 2 + r_cyc;
+void t_machine::write_mem(t_adr adr, char val) {
+    auto& page = pages[(adr >> 8) & 0xffu];
+    if (page.write_ptr != nullptr) {
+        page.write_ptr[adr & 0xffu] = val;
+    } else {
+        (this->*page.write)(adr, val);
     }
+}
 
-    void i_cpy() {
-        auto val = read_mem(arg);
-        set_carry_flag(ry >= val);
-        set_zero_flag(ry == val);
-        set_negative_flag(get_bit(ry - val, 7));
-        cycle_count += 2 + r_cyc;
+void t_machine::sync_ppu() {
+    if (ppu_thread.is_running()) {
+        post_ppu_dots();
+        ppu_thread.wait();
+        posted_dots = 0;
+    } else {
+        ppu.run(pending_dots);
     }
+    pending_dots = 0;
+    nmi_deadline = ppu.get_dots_until_event(t_ppu::event_nmi);
+}
+
+void t_machine::post_ppu_dots() {
+    ppu_thread.run(pending_dots - posted_dots);
+    posted_dots = pending_dots;
+}
 
-    void i_isc() {
-        i_inc();
-        i_sbc();
-        cycle_count = 4 + w_cyc;
+char t_machine::read_ppu(t_adr adr) {
+    sync_ppu();
+    return ppu.get(adr & 0x2007u);
+}
+
+// the ppu thread takes the writes that happen before the nmi and can not
+// raise it, a write to the control register can do so at once
+void t_machine::write_ppu(t_adr adr, char val) {
+    adr &= 0x2007u;
+    if (ppu_thread.is_running() and adr != 0x2000u
+            and pending_dots < nmi_deadline) {
+        ppu_thread.write(pending_dots - posted_dots, adr, val);
+        posted_dots = pending_dots;
+        return;
+    }
+    sync_ppu();
+    ppu.set(adr, val);
+}
+
+char t_machine::read_io(t_adr adr) {
+    if (adr == 0x4016u) {
+        return input.read();
     }
+    return 0x00;
+}
 
-    char read_mem(t_adr adr) {
-        char res = 0;
-        bool bad = false;
-        if (adr < 0x2000u) {
-            adr %= 0x0800u;
-            res = memory[adr];
-        } else if (adr < 0x4000u) {
-            adr &= 0x2007u;
-            res = gfx::get(adr);
-        } else if (adr == 0x4016u) {
-            res = input::read();
-        } else if (adr < 0x8000u) {
-            bad = true;
-        } else if (adr < 0x10000ul) {
-            adr -= 0x8000u;
-            if (prg_rom.size() == 0x4000u) {
-                adr %= 0x4000u;
+void t_machine::write_io(t_adr adr, char val) {
+    if (adr == 0x4014u) {
+        if (ppu_thread.is_running() and pending_dots < nmi_deadline) {
+            post_ppu_dots();
+            for (auto i = 0u; i < 0x100u; i++) {
+                ppu_thread.oam_write(0, read_mem(make_adr(val, char(i))));
             }
-            res = prg_rom[adr];
         } else {
-            switch (adr) {
-            case adr_ra: res = ra; break;
-            case adr_rx: res = rx; break;
-            case adr_ry: res = ry; break;
-            case adr_rp: res = rp; break;
-            case adr_sp: res = sp; break;
-            default: bad = true; break;
+            sync_ppu();
+            for (auto i = 0u; i < 0x100u; i++) {
+                ppu.oam_write(read_mem(make_adr(val, char(i))));
             }
         }
-        bad = false;
-        if (bad) {
-            // log_print_str("machine bad read_mem $"); log_print_hex(adr, 4);
-            // log_print_str("\n");
-            res = 0x00;
+        cycle_count += 513;
+        if (odd_cycle) {
+            cycle_count++;
         }
-        return res;
+    } else if (adr == 0x4016u) {
+        input.write(val);
     }
+}
 
-    void write_mem(t_adr adr, char val) {
-        bool bad = false;
-        if (adr < 0x2000u) {
-            adr %= 0x0800u;
-            memory[adr] = val;
-        } else if (adr < 0x4000u) {
-            adr &= 0x2007u;
-            gfx::set(adr, val);
-        } else if (adr == 0x4014u) {
-            for (auto i = 0u; i < 0x100u; i++) {
-                gfx::oam_write(read_mem(make_adr(val, char(i))));
-            }
-            cycle_count += 513;
-            if (odd_cycle) {
-                cycle_count++;
-            }
-        } else if (adr == 0x4016u) {
-            input::write(val);
-        } else if (adr < 0x8000u) {
-            bad = true;
-        } else if (adr < 0x10000ul) {
-            bad = true;
+void t_machine::map_page(unsigned idx, const char* read_ptr, char* write_ptr) {
+    pages[idx] = { read_ptr, write_ptr, nullptr, nullptr };
+}
+
+void t_machine::map_page(unsigned idx, t_read_handler read,
+        t_write_handler write) {
+    pages[idx] = { nullptr, nullptr, read, write };
+}
+
+void t_machine::map_prg_rom() {
+    clear_block_cache();
+    clear_jit_cache();
+    clear_spin_cache();
+    for (auto i = 0x80u; i < 0x100u; i++) {
+        if (prg_rom.empty()) {
+            map_page(i, &open_bus_page[0], &discard_page[0]);
         } else {
-            switch (adr) {
-            case adr_ra: ra = val; break;
-            case adr_rx: rx = val; break;
-            case adr_ry: ry = val; break;
-            case adr_rp: rp = val; break;
-            case adr_sp: sp = val; break;
-            default: bad = true; break;
-            }
-        }
-        bad = false;
-        if (bad) {
-            // log_print_str("machine bad write_mem $"); log_print_hex(adr, 4);
-            // log_print_str("\n");
+            auto ofs = ((i - 0x80u) * page_size) % prg_rom.size();
+            map_page(i, &prg_rom[ofs], &discard_page[0]);
         }
     }
+}
 
-    t_adr read_mem_2(t_adr adr) {
-        auto v = read_mem(adr);
-        auto u = read_mem(adr + 1);
-        return make_adr(u, v);
+void t_machine::map_memory() {
+    for (auto i = 0x00u; i < 0x20u; i++) {
+        auto ram_page = &memory[(i * page_size) % memory.size()];
+        map_page(i, ram_page, ram_page);
     }
-
-    void set_with_flags(t_adr adr, char v) {
-        write_mem(adr, v);
-        set_zero_flag(v == 0);
-        set_negative_flag(get_bit(v, 7));
+    for (auto i = 0x20u; i < 0x40u; i++) {
+        map_page(i, &t_machine::read_ppu, &t_machine::write_ppu);
     }
-
-    void push(char val) {
-        write_mem(0x100u + sp, val);
-        sp--;
+    map_page(0x40u, &t_machine::read_io, &t_machine::write_io);
+    for (auto i = 0x41u; i < 0x80u; i++) {
+        map_page(i, &open_bus_page[0], &discard_page[0]);
     }
+    map_prg_rom();
+}
 
-    char pull() {
-        sp++;
-        return read_mem(0x100u + sp);
-    }
+t_adr t_machine::read_mem_2(t_adr adr) {
+    auto v = read_mem(adr);
+    auto u = read_mem(adr + 1);
+    return make_adr(u, v);
+}
 
-    void push_adr(t_adr adr) {
-        push(char(adr >> 8));
-        push(char(adr));
-    }
+t_adr t_machine::read_zpg_2(char adr) {
+    auto v = read_mem(adr);
+    auto u = read_mem(char(adr + 1));
+    return make_adr(u, v);
+}
 
-    t_adr pull_adr() {
-        auto v = pull();
-        auto u = pull();
-        return make_adr(u, v);
-    }
+void t_machine::set_with_flags(char& reg, char v) {
+    reg = v;
+    set_result_flags(v);
+}
+
+template <class t_operand>
+void t_machine::set_with_flags(t_operand o, char v) {
+    o.set(v);
+    set_result_flags(v);
+}
+
+void t_machine::push(char val) {
+    write_mem(0x100u + sp, val);
+    sp--;
+}
+
+char t_machine::pull() {
+    sp++;
+    return read_mem(0x100u + sp);
+}
 
-    void short_jump_if(bool cond) {
-        cycle_count += 2;
-        if (cond) {
+void t_machine::push_adr(t_adr adr) {
+    push(char(adr >> 8));
+    push(char(adr));
+}
+
+t_adr t_machine::pull_adr() {
+    auto v = pull();
+    auto u = pull();
+    return make_adr(u, v);
+}
+
+void t_machine::short_jump_if(char ofs, bool cond) {
+    if (cond) {
+        cycle_count++;
+        char old_page = pc >> 8;
+        pc = add_signed_offset(pc, ofs);
+        char new_page = pc >> 8;
+        if (new_page != old_page) {
             cycle_count++;
-            char old_page = pc >> 8;
-            pc = add_signed_offset(pc, read_mem(arg));
-            char new_page = pc >> 8;
-            if (new_page != old_page) {
-                cycle_count++;
-            }
         }
     }
+}
 
-    void set_arg(t_adr adr, int n) {
-        arg = adr;
-        for (int i = 0; i < n; i++) {
-            // log_print_str(" ");
-            // log_print_hex(read_mem(pc), 2);
-            pc++;
-        }
-        // log_fill_with_space();
-    }
+const char* t_machine::get_opcode_str(unsigned op) {
+    return opcodes[op].name;
+}
 
-    const char* get_opcode_str(unsigned op) {
-        switch (op) {
-        case 0x29: case 0x25: case 0x35: case 0x2d: case 0x3d: case 0x39:
-        case 0x21: case 0x31:
-            return "and";
-
-        case 0x49: case 0x45: case 0x55: case 0x4d: case 0x5d: case 0x59:
-        case 0x41: case 0x51:
-            return "eor";
-
-        case 0x09: case 0x05: case 0x15: case 0x0d: case 0x1d: case 0x19:
-        case 0x01: case 0x11:
-            return "ora";
-
-        case 0x24: case 0x2c:
-            return "bit";
-
-        case 0xa9: case 0xa5: case 0xb5: case 0xad: case 0xbd: case 0xb9:
-        case 0xa1: case 0xb1:
-            return "lda";
-
-        case 0xa2: case 0xa6: case 0xb6: case 0xae: case 0xbe:
-            return "ldx";
-
-        case 0xa0: case 0xa4: case 0xb4: case 0xac: case 0xbc:
-            return "ldy";
-
-        case 0x85: case 0x95: case 0x8d: case 0x9d: case 0x99: case 0x81:
-        case 0x91:
-            return "sta";
-
-        case 0x86: case 0x96: case 0x8e:
-            return "stx";
-
-        case 0x84: case 0x94: case 0x8c:
-            return "sty";
-
-        case 0xaa:
-            return "tax";
-        case 0xa8:
-            return "tay";
-        case 0x8a:
-            return "txa";
-        case 0x98:
-            return "tya";
-
-        case 0xe6: case 0xf6: case 0xee: case 0xfe:
-            return "inc";
-        case 0xe8:
-            return "inx";
-        case 0xc8:
-            return "iny";
-
-        case 0xc6: case 0xd6: case 0xce: case 0xde:
-            return "dec";
-        case 0xca:
-            return "dex";
-        case 0x88:
-            return "dey";
-
-        case 0x0a: case 0x06: case 0x16: case 0x0e: case 0x1e:
-            return "asl";
-
-        case 0x4a: case 0x46: case 0x56: case 0x4e: case 0x5e:
-            return "lsr";
-
-        case 0x2a: case 0x26: case 0x36: case 0x2e: case 0x3e:
-            return "rol";
-
-        case 0x6a: case 0x66: case 0x76: case 0x6e: case 0x7e: 
-            return "ror";
-
-        case 0xba:
-            return "tsx";
-        case 0x9a:
-            return "txs";
-        case 0x48:
-            return "pha";
-        case 0x08:
-            return "php";
-        case 0x68:
-            return "pla";
-        case 0x28:
-            return "plp";
-
-        case 0x4c: case 0x6c:
-            return "jmp";
-        case 0x20:
-            return "jsr";
-        case 0x60:
-            return "rts";
-
-        case 0x90:
-            return "bcc";
-        case 0xb0:
-            return "bcs";
-        case 0xf0:
-            return "beq";
-        case 0x30:
-            return "bmi";
-        case 0xd0:
-            return "bne";
-        case 0x10:
-            return "bpl";
-        case 0x50:
-            return "bvc";
-        case 0x70:
-            return "bvs";
-
-        case 0x18:
-            return "clc";
-        case 0xd8:
-            return "cld";
-        case 0x58:
-            return "cli";
-        case 0xb8:
-            return "clv";
-        case 0x38:
-            return "sec";
-        case 0xf8:
-            return "sed";
-        case 0x78:
-            return "sei";
-
-        case 0x69: case 0x65: case 0x75: case 0x6d: case 0x7d: case 0x79:
-        case 0x61: case 0x71:
-            return "adc";
-
-        case 0xe9: case 0xe5: case 0xf5: case 0xed: case 0xfd: case 0xf9:
-        case 0xe1: case 0xf1:
-            return "sbc";
-
-        case 0xc9: case 0xc5: case 0xd5: case 0xcd: case 0xdd: case 0xd9:
-        case 0xc1: case 0xd1:
-            return "cmp";
-
-        case 0xe0: case 0xe4: case 0xec:
-            return "cpx";
-
-        case 0xc0: case 0xc4: case 0xcc:
-            return "cpy";
-
-        case 0xea:
-            return "nop";
-        case 0x00:
-            return "brk";
-        case 0x40:
-            return "rti";
-
-        case 0x04:
-            return "nop";
-        case 0xe7:
-            return "isc";
+void t_machine::set_carry_flag(bool x) {
+    carry = x;
+}
 
-        default:
-            return "xxx";
-        }
-    }
+bool t_machine::get_carry_flag() {
+    return carry;
+}
 
-    void set_carry_flag(bool x) {
-        set_bit(rp, 0, x);
-    }
+void t_machine::set_zero_flag(bool x) {
+    z_result = not x;
+}
 
-    bool get_carry_flag() {
-        return get_bit(rp, 0);
-    }
+bool t_machine::get_zero_flag() {
+    return z_result == 0;
+}
 
-    void set_zero_flag(bool x) {
-        set_bit(rp, 1, x);
-    }
+void t_machine::set_interrupt_disable_flag(bool x) {
+    set_bit(rp, 2, x);
+}
 
-    bool get_zero_flag() {
-        return get_bit(rp, 1);
-    }
+bool t_machine::get_interrupt_disable_flag() {
+    return get_bit(rp, 2);
+}
 
-    void set_interrupt_disable_flag(bool x) {
-        set_bit(rp, 2, x);
-    }
+void t_machine::set_overflow_flag(bool x) {
+    overflow = x;
+}
 
-    bool get_interrupt_disable_flag() {
-        return get_bit(rp, 2);
-    }
+bool t_machine::get_overflow_flag() {
+    return overflow;
+}
 
-    void set_overflow_flag(bool x) {
-        set_bit(rp, 6, x);
-    }
+void t_machine::set_negative_flag(bool x) {
+    n_result = x ? 0x80 : 0x00;
+}
 
-    bool get_overflow_flag() {
-        return get_bit(rp, 6);
-    }
+bool t_machine::get_negative_flag() {
+    return n_result & 0x80u;
+}
 
-    void set_negative_flag(bool x) {
-        set_bit(rp, 7, x);
-    }
+void t_machine::set_break_flag(bool x) {
+    set_bit(rp, 4, x);
+}
 
-    bool get_negative_flag() {
-        return get_bit(rp, 7);
-    }
+bool t_machine::get_break_flag() {
+    return get_bit(rp, 4);
+}
 
-    void set_break_flag(bool x) {
-        set_bit(rp, 4, x);
-    }
+void t_machine::set_result_flags(char v) {
+    n_result = v;
+    z_result = v;
+}
 
-    bool get_break_flag() {
-        return get_bit(rp, 4);
-    }
+char t_machine::get_status() {
+    auto val = rp;
+    set_bit(val, 0, get_carry_flag());
+    set_bit(val, 1, get_zero_flag());
+    set_bit(val, 6, get_overflow_flag());
+    set_bit(val, 7, get_negative_flag());
+    return val;
+}
+
+void t_machine::set_status(char val) {
+    rp = val;
+    set_carry_flag(get_bit(val, 0));
+    set_zero_flag(get_bit(val, 1));
+    set_overflow_flag(get_bit(val, 6));
+    set_negative_flag(get_bit(val, 7));
 }
 
-t_adr machine::get_program_counter() {
+t_machine::t_machine(t_ppu& ppu, t_input& input) :
+    ppu(ppu),
+    input(input),
+    jit_enabled(false),
+    jit_verify(false),
+    ppu_thread(ppu),
+    block_cache(0x10000u - prg_rom_start),
+    cur_block(nullptr),
+    jit_cache(0x10000u - prg_rom_start),
+    spin_cache(0x10000u - prg_rom_start),
+    last_spin() {
+    block_pool.reserve(block_pool_size);
+    jit_instrs.reserve(max_block_length);
+}
+
+t_adr t_machine::get_program_counter() {
     return pc;
 }
 
-void machine::set_program_counter(t_adr adr) {
+void t_machine::set_program_counter(t_adr adr) {
     pc = adr;
 }
 
-int machine::load_program(const std::string& file) {
+int t_machine::load_program(const std::string& file) {
     std::ifstream is(file, std::ios::binary);
     if (!is.good()) {
         return failure;
@@ -1310,10 +1431,16 @@ int machine::load_program(const std::string& file) {
     is.read(&chr_sz, 1);
     char flags;
     is.read(&flags, 1);
-    if (get_bit(flags, 1) or get_bit(flags, 2) or get_bit(flags, 3)) {
+    if (get_bit(flags, 1) or get_bit(flags, 2)) {
         return failure;
     }
-    gfx::set_mirroring(get_bit(flags, 0));
+    if (get_bit(flags, 3)) {
+        ppu.set_mirroring(t_ppu::mirroring_four_screen);
+    } else if (get_bit(flags, 0)) {
+        ppu.set_mirroring(t_ppu::mirroring_vertical);
+    } else {
+        ppu.set_mirroring(t_ppu::mirroring_horizontal);
+    }
     char mapper;
     mapper = get_bits(flags, 4, 4);
     is.read(&flags, 1);
@@ -1327,80 +1454,142 @@ int machine::load_program(const std::string& file) {
     }
     prg_rom.resize(prg_sz * 0x4000u);
     is.read(&prg_rom[0], prg_rom.size());
+    map_memory();
     if (chr_sz == 1) {
-        gfx::load_pattern_table(is);
+        ppu.load_pattern_table(is);
     }
     // pc = 0x8000;
     return success;
 }
 
-char machine::read_memory(t_adr adr) {
+char t_machine::read_memory(t_adr adr) {
     return read_mem(adr);
 }
 
-void machine::print_info() {
+// fnv-1a hash of the internal ram, runs that have to behave the same can be
+// compared by it frame by frame
+unsigned long t_machine::get_ram_hash() {
+    auto res = 0xcbf29ce484222325ul;
+    for (auto x : memory) {
+        res ^= (unsigned char)(x);
+        res *= 0x100000001b3ul;
+    }
+    return res;
+}
+
+void t_machine::print_info() {
     std::cout << "| a : "; print_hex(ra);
     std::cout << " | x : "; print_hex(rx);
     std::cout << " | y : "; print_hex(ry);
     std::cout << " | sp : "; print_hex(sp);
     std::cout << " | pc : "; print_hex(pc);
-    std::cout << " | p : "; print_hex(rp);
+    std::cout << " | p : "; print_hex(get_status());
     std::cout << " | sc : "; print_hex(step_count);
     std::cout << " |\n";
 }
 
-unsigned long machine::get_step_counter() {
+unsigned long t_machine::get_step_counter() {
     return step_count;
 }
 
-unsigned long machine::get_cycle_counter() {
+unsigned long t_machine::get_cycle_counter() {
     return cycle_count;
 }
 
-void machine::cycle() {
-    if (cycle_count == 0) {
-        if (not ready) {
-            return;
-        }
-        auto ret = step();
-        if (ret == -1) {
-            // log_print_line("error : bad opcode");
-            // log_print_line("exit");
-            exit(1);
+// runs the given number of cpu cycles, the same as calling cycle on the ppu
+// three times and then on the cpu for each of them, but instructions are run
+// whole and the ppu only catches up when needed and at the end
+void t_machine::run_cycles(unsigned long cycles) {
+    while (cycles > 0) {
+        if (cycle_count == 0) {
+            if (not ready) {
+                pending_dots += 3 * cycles;
+                break;
+            }
+            pending_dots += 3;
+            if (pending_dots >= nmi_deadline) {
+                sync_ppu();
+            } else if (pending_dots - posted_dots >= ppu_post_interval
+                    and ppu_thread.is_running()) {
+                post_ppu_dots();
+            }
+            auto ret = step();
+            if (ret == -1) {
+                // log_print_line("error : bad opcode");
+                // log_print_line("exit");
+                exit(1);
+            }
+            cycle_count--;
+            odd_cycle = not odd_cycle;
+            cycles--;
+        } else {
+            auto n = std::min(cycle_count, cycles);
+            pending_dots += 3 * n;
+            cycle_count -= n;
+            if (n % 2 == 1) {
+                odd_cycle = not odd_cycle;
+            }
+            cycles -= n;
         }
     }
-    cycle_count--;
-    odd_cycle = not odd_cycle;
+    sync_ppu();
 }
 
-void machine::halt() {
+// runs up to the end of the cpu cycle in which the ppu starts the next frame
+void t_machine::run_frame() {
+    run_cycles((ppu.get_dots_until_frame_end() + 2) / 3);
+}
+
+void t_machine::halt() {
     ready = false;
 }
 
-bool machine::is_halted() {
+bool t_machine::is_halted() {
     return not ready;
 }
 
-void machine::resume() {
+void t_machine::resume() {
     ready = true;
 }
 
-void machine::set_nmi_flag(bool val) {
+void t_machine::set_jit(bool enabled, bool verify) {
+    jit_enabled = enabled and jit::is_supported();
+    jit_verify = verify;
+}
+
+// the ppu is only used from the thread of the cpu while the ppu thread is
+// stopped or has replayed the whole journal
+void t_machine::set_ppu_thread(bool enabled) {
+    if (enabled) {
+        sync_ppu();
+        ppu_thread.start();
+    } else {
+        sync_ppu();
+        ppu_thread.stop();
+    }
+}
+
+void t_machine::set_nmi_flag(bool val) {
     nmi_flag = val;
 }
 
-void machine::init() {
+void t_machine::init() {
     sp = 0xff;
     ra = 0x00;
     rx = 0x00;
     ry = 0x00;
-    rp = 0x34;
+    set_status(0x34);
     std::fill(memory.begin(), memory.end(), 0x00);
+    std::fill(open_bus_page.begin(), open_bus_page.end(), 0x00);
+    map_memory();
     nmi_flag = 0;
     irq_flag = 0;
     reset_flag = 1;
     step_count = 0;
     cycle_count = 0;
     odd_cycle = false;
+    pending_dots = 0;
+    nmi_deadline = 0;
+    posted_dots = 0;
     ready = true;
 }
@@ -1,11 +1,22 @@
 #pragma once
 
 #include <array>
+#include <string>
 #include <vector>
 
-using t_adr = unsigned long;
+#include "misc.hpp"
+#include "jit.hpp"
+#include "ppu_thread.hpp"
+
+class t_ppu;
+class t_input;
+
+class t_machine {
+public:
+    t_machine(t_ppu&, t_input&);
+    t_machine(const t_machine&) = delete;
+    t_machine& operator=(const t_machine&) = delete;
 
-namespace machine {
     void init();
     void set_program_counter(t_adr);
     t_adr get_program_counter();
@@ -13,11 +24,376 @@ namespace machine {
     unsigned long get_cycle_counter();
     void print_info();
     char read_memory(t_adr);
+    unsigned long get_ram_hash();
     int load_program(const std::string&);
     void reset();
-    void cycle();
+    void run_cycles(unsigned long);
+    void run_frame();
     void halt();
     bool is_halted();
     void resume();
+    void set_jit(bool, bool = false);
+    void set_ppu_thread(bool);
     void set_nmi_flag(bool = true);
-}
+
+private:
+    t_ppu& ppu;
+    t_input& input;
+
+    bool reset_flag;
+    bool nmi_flag;
+    bool irq_flag;
+
+    bool ready;
+
+    bool jit_enabled;
+    bool jit_verify;
+
+    std::array<char, 0x0800> memory;
+    std::vector<char> prg_rom;
+
+    // memory map, one entry per 256 byte page of the cpu bus, pages without
+    // a pointer are handled by callbacks
+
+    using t_read_handler = char (t_machine::*)(t_adr);
+    using t_write_handler = void (t_machine::*)(t_adr, char);
+
+    struct t_page {
+        const char* read_ptr;
+        char* write_ptr;
+        t_read_handler read;
+        t_write_handler write;
+    };
+
+    std::array<t_page, 0x100> pages;
+    std::array<char, 0x100> open_bus_page;
+    std::array<char, 0x100> discard_page;
+
+    unsigned long step_count;
+    unsigned long cycle_count;
+    bool odd_cycle;
+
+    // the ppu is run lazily, it owes the dots of the cpu cycles run since the
+    // last sync and is caught up before the cpu can observe it, either
+    // through its registers or through the nmi, the cpu runs uninterrupted
+    // until the next nmi event the ppu reports
+
+    unsigned long pending_dots;
+    unsigned long nmi_deadline;
+
+    // with the ppu on its own thread, the pending dots are handed to it as
+    // they go by together with the writes the cpu can not observe at once,
+    // posted_dots of them have been handed over
+
+    t_ppu_thread ppu_thread;
+    unsigned long posted_dots;
+    std::string instr_arg_str;
+    unsigned cur_opcode;
+
+    // registers
+
+    t_adr pc; // program counter
+    char sp; // stack pointer
+    char ra; // accumulator
+    char rx; // x
+    char ry; // y
+    char rp; // processor status
+
+    // n and z are derived from the last result only when they are read, c
+    // and v are kept apart from rp until it is read as a whole
+
+    char n_result; // n is bit 7
+    char z_result; // z is set when it is 0
+    bool carry;
+    bool overflow;
+
+    // addressing modes
+
+    enum t_mode {
+        m_imp, m_acc, m_imm, m_rel, m_zpg, m_zpx, m_zpy,
+        m_abs, m_abx, m_aby, m_ind, m_inx, m_iny
+    };
+
+    // helper functions
+
+    void set_carry_flag(bool);
+    bool get_carry_flag();
+    void set_zero_flag(bool);
+    bool get_zero_flag();
+    void set_overflow_flag(bool);
+    bool get_overflow_flag();
+    void set_negative_flag(bool);
+    bool get_negative_flag();
+    void set_interrupt_disable_flag(bool);
+    bool get_interrupt_disable_flag();
+    void set_break_flag(bool);
+    bool get_break_flag();
+    void set_result_flags(char);
+    char get_status();
+    void set_status(char);
+    char read_mem(t_adr);
+    t_adr read_mem_2(t_adr);
+    t_adr read_zpg_2(char);
+    void write_mem(t_adr, char);
+    void set_with_flags(char&, char);
+    template <class t_operand> void set_with_flags(t_operand, char);
+    void push(char);
+    char pull();
+    void push_adr(t_adr);
+    t_adr pull_adr();
+    void short_jump_if(char, bool);
+    void compare(char, char);
+    const char* get_opcode_str(unsigned);
+    void process_interrupt();
+
+    // operand kinds
+
+    struct t_no_operand {
+    };
+
+    struct t_value_operand {
+        char val;
+        char get() const { return val; }
+    };
+
+    struct t_acc_operand {
+        t_machine* m;
+        char get() const { return m->ra; }
+        void set(char val) const { m->ra = val; }
+    };
+
+    struct t_mem_operand {
+        t_machine* m;
+        t_adr adr;
+        char get() const { return m->read_mem(adr); }
+        void set(char val) const { m->write_mem(adr, val); }
+    };
+
+    template <t_mode mode>
+    struct t_operand_of {
+        using type = t_mem_operand;
+    };
+
+    template <t_mode mode>
+    using t_mode_operand = typename t_operand_of<mode>::type;
+
+    // instructions
+
+    template <class t_operand> void i_lda(t_operand);
+    template <class t_operand> void i_ldx(t_operand);
+    template <class t_operand> void i_ldy(t_operand);
+
+    void i_sta(t_mem_operand);
+    void i_stx(t_mem_operand);
+    void i_sty(t_mem_operand);
+
+    void i_tax(t_no_operand);
+    void i_tay(t_no_operand);
+    void i_txa(t_no_operand);
+    void i_tya(t_no_operand);
+    void i_tsx(t_no_operand);
+    void i_txs(t_no_operand);
+
+    void i_pha(t_no_operand);
+    void i_pla(t_no_operand);
+
+    void i_php(t_no_operand);
+    void i_plp(t_no_operand);
+
+    template <class t_operand> void i_and(t_operand);
+    template <class t_operand> void i_eor(t_operand);
+    template <class t_operand> void i_ora(t_operand);
+    void i_bit(t_mem_operand);
+
+    void i_inc(t_mem_operand);
+    void i_dec(t_mem_operand);
+
+    void i_inx(t_no_operand);
+    void i_dex(t_no_operand);
+    void i_iny(t_no_operand);
+    void i_dey(t_no_operand);
+
+    void i_jmp(t_mem_operand);
+    void i_jsr(t_mem_operand);
+    void i_rts(t_no_operand);
+
+    void i_clc(t_no_operand);
+    void i_sec(t_no_operand);
+    void i_clv(t_no_operand);
+    void i_cld(t_no_operand);
+    void i_sed(t_no_operand);
+    void i_cli(t_no_operand);
+    void i_sei(t_no_operand);
+
+    void i_bcc(t_value_operand);
+    void i_bcs(t_value_operand);
+    void i_bpl(t_value_operand);
+    void i_bmi(t_value_operand);
+    void i_bne(t_value_operand);
+    void i_beq(t_value_operand);
+    void i_bvc(t_value_operand);
+    void i_bvs(t_value_operand);
+
+    void i_brk(t_no_operand);
+    void i_rti(t_no_operand);
+    template <class t_operand> void i_nop(t_operand);
+
+    template <class t_operand> void i_asl(t_operand);
+    template <class t_operand> void i_lsr(t_operand);
+    template <class t_operand> void i_rol(t_operand);
+    template <class t_operand> void i_ror(t_operand);
+
+    template <class t_operand> void i_adc(t_operand);
+    template <class t_operand> void i_sbc(t_operand);
+    template <class t_operand> void i_cmp(t_operand);
+    template <class t_operand> void i_cpx(t_operand);
+    template <class t_operand> void i_cpy(t_operand);
+
+    void i_isc(t_mem_operand);
+
+    // opcode table
+
+    using t_exec = bool (*)(t_machine&, t_adr);
+
+    struct t_opcode {
+        const char* name;
+        t_exec exec;
+        t_mode mode;
+        unsigned size;
+        unsigned cycles;
+        bool page_penalty;
+    };
+
+    static constexpr t_opcode op_xxx = { "xxx", nullptr, m_imp, 1, 0, false };
+    // the decoding of all 256 opcodes, a constant expression once defined
+    static const std::array<t_opcode, 0x100> opcodes;
+
+    static constexpr unsigned get_mode_size(t_mode);
+    t_adr add_index(t_adr, char, bool&);
+    template <t_mode mode> t_adr resolve_adr(t_adr, bool&);
+    template <t_mode mode> t_mode_operand<mode> resolve(t_adr, bool&);
+
+    template <t_mode mode, void (t_machine::*instr)(t_mode_operand<mode>)>
+    static bool exec(t_machine&, t_adr);
+
+    template <t_mode mode, void (t_machine::*instr)(t_mode_operand<mode>)>
+    static constexpr t_opcode op(const char*, unsigned, bool = false);
+
+    // decoded instructions, straight-line runs of prg rom code are decoded
+    // once into blocks and replayed from there until the mapping changes
+
+    struct t_decoded {
+        t_exec exec;
+        t_adr operand;
+        char opcode;
+        char size;
+        char cycles;
+        bool page_penalty;
+    };
+
+    // a range of the block pool, the pool is emptied instead of growing
+    // past its reserved size so the ranges stay valid and nothing allocates
+    struct t_block {
+        const t_decoded* first;
+        unsigned length;
+
+        const t_decoded* begin() const { return first; }
+        const t_decoded* end() const { return first + length; }
+        unsigned size() const { return length; }
+        bool empty() const { return length == 0; }
+        const t_decoded& operator[](unsigned i) const { return first[i]; }
+    };
+
+    std::vector<t_decoded> block_pool;
+    std::vector<t_block> block_cache;
+    const t_block* cur_block;
+    unsigned cur_block_idx;
+    t_adr cur_block_pc;
+
+    t_decoded decode(t_adr);
+    const t_block& get_block(t_adr);
+    const t_decoded* fetch_cached(t_adr);
+    void clear_block_cache();
+    int execute();
+    int step();
+
+    // translated blocks of hot prg rom code
+
+    struct t_jit_entry {
+        jit::t_block fn;
+        unsigned hits;
+    };
+
+    std::vector<t_jit_entry> jit_cache;
+    std::vector<jit::t_instr> jit_instrs;
+    jit::t_arena jit_arena;
+
+    bool is_bus_safe(const t_decoded&);
+    jit::t_block translate(t_adr);
+    jit::t_block get_jit_block(t_adr);
+    void clear_jit_cache();
+
+    // idle loops, a loop at the head of a prg rom block that only reads ram,
+    // prg rom or the ppu status and branches back to its head does the same
+    // on every iteration once the registers repeat, until the status changes
+    // or an nmi arrives, so those iterations are skipped in bulk
+
+    struct t_spin_info {
+        bool analyzed;
+        bool idle;
+        bool reads_status;
+        unsigned length;
+        unsigned cycles;
+    };
+
+    struct t_spin_state {
+        t_adr head;
+        unsigned long step_count;
+        char ra;
+        char rx;
+        char ry;
+        char sp;
+        char rp;
+    };
+
+    std::vector<t_spin_info> spin_cache;
+    t_spin_state last_spin;
+
+    t_spin_info analyze_spin(t_adr);
+    const t_spin_info& get_spin_info(t_adr);
+    void clear_spin_cache();
+    void skip_idle_loop();
+
+    // differential checking of translated blocks against the interpreter
+
+    struct t_cpu_state {
+        std::array<char, 0x0800> memory;
+        t_adr pc;
+        char sp;
+        char ra;
+        char rx;
+        char ry;
+        char rp;
+        unsigned long cycle_count;
+        unsigned long step_count;
+    };
+
+    t_cpu_state save_state();
+    void load_state(const t_cpu_state&);
+    static bool same_state(const t_cpu_state&, const t_cpu_state&);
+    static void print_state(const char*, const t_cpu_state&);
+    void run_jit_block(jit::t_block);
+
+    // bus
+
+    void sync_ppu();
+    void post_ppu_dots();
+    char read_ppu(t_adr);
+    void write_ppu(t_adr, char);
+    char read_io(t_adr);
+    void write_io(t_adr, char);
+    void map_page(unsigned, const char*, char*);
+    void map_page(unsigned, t_read_handler, t_write_handler);
+    void map_prg_rom();
+    void map_memory();
+};
@@ -1,42 +1,185 @@
 #include <iostream>
 #include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 #include <cstdio>
 
-#include "gfx.hpp"
-#include "machine.hpp"
+#include "console.hpp"
+#include "logger.hpp"
+#include "alloc.hpp"
 #include "misc.hpp"
 
+// frames run before allocations are expected to stop, code seen for the
+// first time still fills the block and jit caches until then
+const auto alloc_warmup_frames = 120ul;
+
+// parses a comma separated list of log categories, all of them when empty
+bool parse_log_categories(const std::string& list, unsigned& res) {
+    const std::vector<std::pair<std::string, unsigned>> names = {
+        { "reg", logger::cat_ppu_reg },
+        { "fetch", logger::cat_ppu_fetch },
+        { "sprite", logger::cat_ppu_sprite },
+        { "frame", logger::cat_ppu_frame }
+    };
+    res = list.empty() ? unsigned(logger::cat_ppu) : 0;
+    auto pos = 0ul;
+    while (pos < list.size()) {
+        auto end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        auto name = list.substr(pos, end - pos);
+        auto found = false;
+        for (auto& x : names) {
+            if (x.first == name) {
+                res |= x.second;
+                found = true;
+            }
+        }
+        if (not found) {
+            return false;
+        }
+        pos = end + 1;
+    }
+    return true;
+}
+
 int main(int argc, char** argv) {
-    if (argc < 2 or argc >= 4) {
+    std::vector<std::string> args;
+    auto jit = false;
+    auto jit_verify = false;
+    auto log_categories = 0u;
+    auto count_allocs = false;
+    auto max_frames = 0ul;
+    auto frame_skip = 0ul;
+    auto auto_frame_skip = false;
+    auto ram_hash = false;
+    auto ppu_thread = false;
+    auto render_threads = 0ul;
+    auto headless = false;
+    for (auto i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--log" or arg.compare(0, 6, "--log=") == 0) {
+            auto list = arg.size() > 6 ? arg.substr(6) : "";
+            if (not parse_log_categories(list, log_categories)) {
+                std::cout << "invalid log categories\n";
+                return 1;
+            }
+        } else if (arg == "--count-allocs") {
+            count_allocs = true;
+        } else if (arg.compare(0, 9, "--frames=") == 0) {
+            max_frames = std::stoul(arg.substr(9));
+        } else if (arg == "--frame-skip=auto") {
+            auto_frame_skip = true;
+        } else if (arg.compare(0, 13, "--frame-skip=") == 0) {
+            frame_skip = std::stoul(arg.substr(13));
+        } else if (arg == "--ppu-thread") {
+            ppu_thread = true;
+        } else if (arg.compare(0, 17, "--render-threads=") == 0) {
+            render_threads = std::stoul(arg.substr(17));
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--ram-hash") {
+            ram_hash = true;
+        } else if (arg == "--jit") {
+            jit = true;
+        } else if (arg == "--jit-verify") {
+            jit = true;
+            jit_verify = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() < 1 or args.size() >= 3) {
         std::cout << "invalid arguments\n";
         return 1;
     }
     unsigned long fps = 60;
-    if (argc == 3) {
-        fps = std::stoul(argv[2]);
+    if (args.size() == 2) {
+        fps = std::stoul(args[1]);
+    }
+
+    if (count_allocs and not alloc::is_counting()) {
+        std::cout << "allocation counting needs a COUNT_ALLOCS build\n";
+        return 1;
     }
 
-    machine::init();
-    gfx::init();
-    auto ret = machine::load_program(argv[1]);
+    if (log_categories != 0) {
+        if (logger::compiled_level < logger::level_debug) {
+            std::cout << "ppu logging is not built in, build with "
+                "log_level=level_trace\n";
+            return 1;
+        }
+        logger::set_level(logger::level_trace);
+        logger::set_categories(log_categories);
+        if (logger::open("ppu_log.txt") != success) {
+            return 1;
+        }
+    }
+
+    // sdl is only set up when there is a window to show
+    std::unique_ptr<t_sdl_session> sdl_session;
+    if (not headless) {
+        sdl_session = std::make_unique<t_sdl_session>();
+        if (not sdl_session->is_ready()) {
+            return 1;
+        }
+    }
+
+    t_console console;
+    console.set_headless(headless);
+    if (console.init() != success) {
+        return 1;
+    }
+    console.set_jit(jit, jit_verify);
+    auto ret = console.load_program(args[0]);
     if (ret != success) {
         std::cout << "could not load file\n";
         return 1;
     }
 
-    gfx::set_frames_per_second(fps);
+    console.set_frames_per_second(fps);
+    console.set_frame_skip(frame_skip, auto_frame_skip);
+    console.set_ppu_thread(ppu_thread);
+    console.set_render_threads(render_threads);
 
-    while (gfx::is_running()) {
-        if (gfx::should_poll()) {
-            gfx::poll();
+    auto frame = 0ul;
+    auto allocs = alloc::get_count();
+    auto steady_allocs = 0ul;
+    while (console.is_running()) {
+        if (max_frames != 0 and frame == max_frames) {
+            break;
+        }
+        if (console.should_poll()) {
+            console.poll();
         } else {
-            gfx::cycle();
-            gfx::cycle();
-            gfx::cycle();
-            machine::cycle();
+            console.run();
+            frame++;
+            if (ram_hash) {
+                auto hash = console.get_machine().get_ram_hash();
+                std::printf("frame %lu ram %016lx\n", frame, hash);
+            }
+            if (count_allocs) {
+                auto n = alloc::get_count() - allocs;
+                allocs += n;
+                if (n != 0) {
+                    std::cout << "frame " << frame << " allocs " << n << "\n";
+                }
+                if (frame > alloc_warmup_frames) {
+                    steady_allocs += n;
+                }
+            }
         }
     }
 
-    gfx::close();
+    console.close();
+    logger::close();
+
+    if (count_allocs) {
+        std::cout << "allocs after warmup " << steady_allocs << "\n";
+        if (steady_allocs != 0) {
+            return 1;
+        }
+    }
 }
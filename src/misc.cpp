@@ -1,21 +1,8 @@
 #include <cstdio>
 #include <iostream>
-#include <cstdarg>
 
 #include "misc.hpp"
 
-const auto debug_mode = true;
-
-void debug_print(FILE* fp, const char* fmt, ...) {
-    if (not debug_mode) {
-        return;
-    }
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(fp, fmt, ap);
-    va_end(ap);
-}
-
 bool get_bit(unsigned x, unsigned n) {
     return x & (1u << n);
 }
@@ -66,16 +53,6 @@ bool in_range(unsigned x, unsigned a, unsigned b) {
     return x >= a and x < b;
 }
 
-unsigned bin_num_le(const std::vector<bool>& v) {
-    auto res = 0u;
-    auto e = 1u;
-    for (auto x : v) {
-        res += x * e;
-        e <<= 1;
-    }
-    return res;
-}
-
 char get_bits(char x, unsigned m, unsigned n) {
     return (x >> m) & ((1u << n) - 1u);
 }
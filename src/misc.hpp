@@ -18,7 +18,8 @@ public:
     }
 };
 
-void debug_print(FILE*, const char*, ...);
+using t_adr = unsigned long;
+
 bool get_bit(unsigned, unsigned);
 void set_bit(char&, unsigned, bool = 1);
 void set_bit(unsigned&, unsigned, bool = 1);
@@ -30,7 +31,6 @@ void print_hex(char);
 void print_hex(unsigned);
 void print_hex(unsigned long);
 bool in_range(unsigned, unsigned, unsigned);
-unsigned bin_num_le(const std::vector<bool>&);
 char get_bits(char, unsigned, unsigned);
 unsigned get_bits(unsigned, unsigned, unsigned);
 void set_bits(char&, unsigned, unsigned, char);
@@ -0,0 +1,86 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mix.hpp"
+
+#if defined(__AVX2__)
+
+bool mix::compose(const t_line& bg, const t_line& spr, const t_line& spr_front,
+        const t_line& spr_zero, char backdrop, char transparent, t_line& out) {
+    auto t = _mm256_set1_epi8(transparent);
+    auto b = _mm256_set1_epi8(backdrop);
+    auto hit = _mm256_setzero_si256();
+    // no blendv, gcc treats its mask as char which is unsigned in this build
+    auto blend = [](__m256i x, __m256i y, __m256i mask) {
+        return _mm256_or_si256(_mm256_andnot_si256(mask, x),
+                _mm256_and_si256(mask, y));
+    };
+    for (auto i = 0u; i < out.size(); i += 32) {
+        auto load = [i](const t_line& x) {
+            return _mm256_loadu_si256((const __m256i*) &x[i]);
+        };
+        auto vbg = load(bg);
+        auto vspr = load(spr);
+        auto bg_t = _mm256_cmpeq_epi8(vbg, t);
+        auto spr_t = _mm256_cmpeq_epi8(vspr, t);
+        auto use_spr = _mm256_or_si256(bg_t,
+                _mm256_andnot_si256(spr_t, load(spr_front)));
+        auto pixel = blend(vbg, vspr, use_spr);
+        pixel = blend(pixel, b, _mm256_cmpeq_epi8(pixel, t));
+        _mm256_storeu_si256((__m256i*) &out[i], pixel);
+        hit = _mm256_or_si256(hit, _mm256_andnot_si256(bg_t, load(spr_zero)));
+    }
+    return not _mm256_testz_si256(hit, hit);
+}
+
+#elif defined(__SSE2__)
+
+bool mix::compose(const t_line& bg, const t_line& spr, const t_line& spr_front,
+        const t_line& spr_zero, char backdrop, char transparent, t_line& out) {
+    auto t = _mm_set1_epi8(transparent);
+    auto b = _mm_set1_epi8(backdrop);
+    auto hit = _mm_setzero_si128();
+    auto blend = [](__m128i x, __m128i y, __m128i mask) {
+        return _mm_or_si128(_mm_andnot_si128(mask, x), _mm_and_si128(mask, y));
+    };
+    for (auto i = 0u; i < out.size(); i += 16) {
+        auto load = [i](const t_line& x) {
+            return _mm_loadu_si128((const __m128i*) &x[i]);
+        };
+        auto vbg = load(bg);
+        auto vspr = load(spr);
+        auto bg_t = _mm_cmpeq_epi8(vbg, t);
+        auto spr_t = _mm_cmpeq_epi8(vspr, t);
+        auto use_spr = _mm_or_si128(bg_t,
+                _mm_andnot_si128(spr_t, load(spr_front)));
+        auto pixel = blend(vbg, vspr, use_spr);
+        pixel = blend(pixel, b, _mm_cmpeq_epi8(pixel, t));
+        _mm_storeu_si128((__m128i*) &out[i], pixel);
+        hit = _mm_or_si128(hit, _mm_andnot_si128(bg_t, load(spr_zero)));
+    }
+    return _mm_movemask_epi8(hit) != 0;
+}
+
+#else
+
+bool mix::compose(const t_line& bg, const t_line& spr, const t_line& spr_front,
+        const t_line& spr_zero, char backdrop, char transparent, t_line& out) {
+    auto hit = false;
+    for (auto i = 0u; i < out.size(); i++) {
+        auto pixel = bg[i];
+        if (pixel == transparent or (spr_front[i] and spr[i] != transparent)) {
+            pixel = spr[i];
+        }
+        if (pixel == transparent) {
+            pixel = backdrop;
+        }
+        out[i] = pixel;
+        hit |= spr_zero[i] and bg[i] != transparent;
+    }
+    return hit;
+}
+
+#endif
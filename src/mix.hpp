@@ -0,0 +1,16 @@
+#pragma once
+
+#include <array>
+
+namespace mix {
+    using t_line = std::array<char, 256>;
+
+    // merges a line of background and sprite colors, where either may be
+    // transparent, spr_front and spr_zero are all ones for the sprite pixels
+    // in front of the background and for the ones of sprite 0, transparent
+    // results become the backdrop color, returns whether an opaque pixel of
+    // sprite 0 is on an opaque background pixel
+    bool compose(const t_line& bg, const t_line& spr, const t_line& spr_front,
+            const t_line& spr_zero, char backdrop, char transparent,
+            t_line& out);
+}
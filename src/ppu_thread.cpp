@@ -0,0 +1,99 @@
+#include "ppu_thread.hpp"
+#include "gfx.hpp"
+
+const auto journal_size = 1u << 16;
+
+t_ppu_thread::t_ppu_thread(t_ppu& ppu) :
+    ppu(ppu),
+    running(false),
+    head(0),
+    tail(0),
+    stopping(false) {
+}
+
+t_ppu_thread::~t_ppu_thread() {
+    stop();
+}
+
+void t_ppu_thread::start() {
+    if (running) {
+        return;
+    }
+    journal.resize(journal_size);
+    head = 0;
+    tail = 0;
+    stopping = false;
+    worker = std::thread(&t_ppu_thread::replay, this);
+    running = true;
+}
+
+// lets the thread replay what is left in the journal and joins it
+void t_ppu_thread::stop() {
+    if (not running) {
+        return;
+    }
+    stopping = true;
+    worker.join();
+    running = false;
+}
+
+bool t_ppu_thread::is_running() {
+    return running;
+}
+
+void t_ppu_thread::run(unsigned long dots) {
+    if (dots > 0) {
+        push({ dots, kind_run, 0, 0 });
+    }
+}
+
+void t_ppu_thread::write(unsigned long dots, unsigned adr, char val) {
+    push({ dots, kind_write, adr, val });
+}
+
+void t_ppu_thread::oam_write(unsigned long dots, char val) {
+    push({ dots, kind_oam_write, 0, val });
+}
+
+// returns once the journal has been replayed, the ppu can then be used from
+// the calling thread until the next entry is pushed
+void t_ppu_thread::wait() {
+    auto h = head.load(std::memory_order_relaxed);
+    while (tail.load(std::memory_order_acquire) != h) {
+        std::this_thread::yield();
+    }
+}
+
+void t_ppu_thread::push(const t_entry& entry) {
+    auto h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == journal_size) {
+        std::this_thread::yield();
+    }
+    journal[h % journal_size] = entry;
+    head.store(h + 1, std::memory_order_release);
+}
+
+void t_ppu_thread::replay() {
+    auto t = tail.load(std::memory_order_relaxed);
+    while (true) {
+        auto stop = stopping.load();
+        auto h = head.load(std::memory_order_acquire);
+        if (t == h) {
+            if (stop) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        for (; t != h; t++) {
+            auto& entry = journal[t % journal_size];
+            ppu.run(entry.dots);
+            if (entry.kind == kind_write) {
+                ppu.set(entry.adr, entry.val);
+            } else if (entry.kind == kind_oam_write) {
+                ppu.oam_write(entry.val);
+            }
+        }
+        tail.store(t, std::memory_order_release);
+    }
+}
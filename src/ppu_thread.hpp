@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class t_ppu;
+
+// runs a ppu on a thread of its own, the cpu appends its register writes to
+// a journal together with the dots the ppu has to run before each of them,
+// and the thread replays the journal into the ppu
+class t_ppu_thread {
+public:
+    t_ppu_thread(t_ppu&);
+    ~t_ppu_thread();
+    t_ppu_thread(const t_ppu_thread&) = delete;
+    t_ppu_thread& operator=(const t_ppu_thread&) = delete;
+
+    void start();
+    void stop();
+    bool is_running();
+    void run(unsigned long);
+    void write(unsigned long, unsigned, char);
+    void oam_write(unsigned long, char);
+    void wait();
+
+private:
+    enum t_kind : unsigned {
+        kind_run,
+        kind_write,
+        kind_oam_write
+    };
+
+    struct t_entry {
+        unsigned long dots;
+        t_kind kind;
+        unsigned adr;
+        char val;
+    };
+
+    t_ppu& ppu;
+    bool running;
+
+    // single producer single consumer ring, the cpu pushes and the thread
+    // replays, a full ring makes the cpu wait
+    std::vector<t_entry> journal;
+    alignas(64) std::atomic<unsigned long> head;
+    alignas(64) std::atomic<unsigned long> tail;
+    std::atomic<bool> stopping;
+    std::thread worker;
+
+    void push(const t_entry&);
+    void replay();
+};
@@ -0,0 +1,147 @@
+#include "render_pool.hpp"
+
+// lines per band, enough to make handing them over cheap and few enough to
+// keep the threads busy while the frame is still running
+const auto band_lines = 16u;
+
+t_render_pool::t_render_pool() :
+    bands_submitted(0),
+    bands_taken(0),
+    bands_pending(0),
+    stopping(false),
+    band_first(0),
+    band_end(0) {
+}
+
+t_render_pool::~t_render_pool() {
+    stop();
+}
+
+void t_render_pool::start(unsigned threads) {
+    stop();
+    stopping = false;
+    bands_submitted = 0;
+    bands_taken = 0;
+    bands_pending = 0;
+    band_first = 0;
+    band_end = 0;
+    for (auto i = 0u; i < threads; i++) {
+        workers.emplace_back(&t_render_pool::work, this);
+    }
+}
+
+void t_render_pool::stop() {
+    if (workers.empty()) {
+        return;
+    }
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& x : workers) {
+        x.join();
+    }
+    workers.clear();
+}
+
+bool t_render_pool::is_running() {
+    return not workers.empty();
+}
+
+t_line_record& t_render_pool::get_record(unsigned line) {
+    return records[line];
+}
+
+// adds a recorded line to the open band, a line that does not follow the
+// band starts a new one
+void t_render_pool::add(unsigned line) {
+    if (band_first != band_end and line != band_end) {
+        submit();
+    }
+    if (band_first == band_end) {
+        band_first = line;
+        band_end = line;
+    }
+    band_end++;
+    if (band_end - band_first == band_lines) {
+        submit();
+    }
+}
+
+// hands over the open band and returns once every band has been drawn
+void t_render_pool::finish() {
+    submit();
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return bands_pending == 0; });
+    bands_submitted = 0;
+    bands_taken = 0;
+}
+
+void t_render_pool::submit() {
+    if (band_first == band_end) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bands[bands_submitted % bands.size()] = { band_first, band_end };
+        bands_submitted++;
+        bands_pending++;
+    }
+    band_first = band_end;
+    work_ready.notify_one();
+}
+
+void t_render_pool::work() {
+    while (true) {
+        t_band band;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [this] {
+                return stopping or bands_taken != bands_submitted;
+            });
+            if (bands_taken == bands_submitted) {
+                return;
+            }
+            band = bands[bands_taken % bands.size()];
+            bands_taken++;
+        }
+        for (auto i = band.first; i < band.last; i++) {
+            compose_line(records[i]);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bands_pending--;
+        }
+        work_done.notify_all();
+    }
+}
+
+// draws a recorded line into its out, when it has one, and returns whether
+// an opaque pixel of sprite 0 is on an opaque background pixel, the ppu
+// draws the lines it runs itself with it as well
+bool compose_line(const t_line_record& rec) {
+    auto get_pixel = [](char pal_idx) {
+        return pal_idx % 4 == 0 ? transparent_pixel : pal_idx;
+    };
+
+    mix::t_line bg;
+    if (rec.show_background) {
+        for (auto x = 0u; x < bg.size(); x++) {
+            bg[x] = get_pixel(rec.bg[x + rec.fine_x]);
+        }
+    } else {
+        bg.fill(get_pixel(rec.bg[rec.fine_x]));
+    }
+
+    mix::t_line pixels;
+    auto hit = mix::compose(bg, rec.spr_pixels, rec.spr_front, rec.spr_zero,
+            0, transparent_pixel, pixels);
+    if (rec.out != nullptr) {
+        for (auto x = 0u; x < pixels.size(); x++) {
+            rec.out[x] = rec.palette[unsigned(pixels[x])];
+        }
+    }
+    return hit;
+}
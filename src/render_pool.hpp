@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mix.hpp"
+
+// the palette index of pixels nothing opaque is drawn at
+const auto transparent_pixel = char(0xff);
+
+// what a visible line is drawn from, the ppu records it while running the
+// line and draws it once run or leaves it to a thread of the pool
+struct t_line_record {
+    uint32_t* out;
+    bool show_background;
+    unsigned fine_x;
+    std::array<uint32_t, 0x20> palette;
+
+    // the palette indices of the two tiles in the shifters at the start of
+    // the line followed by the rows of the 32 tiles fetched after them
+    std::array<char, 16 + 256> bg;
+
+    // the sprite line the ppu built for the 256 dots, while sprites are
+    // hidden the whole line shows the one pixel they are at
+    mix::t_line spr_pixels;
+    mix::t_line spr_front;
+    mix::t_line spr_zero;
+};
+
+bool compose_line(const t_line_record&);
+
+// threads that draw recorded lines, the lines are handed over in bands of
+// consecutive ones while the ppu goes on with the next lines
+class t_render_pool {
+public:
+    t_render_pool();
+    ~t_render_pool();
+    t_render_pool(const t_render_pool&) = delete;
+    t_render_pool& operator=(const t_render_pool&) = delete;
+
+    void start(unsigned);
+    void stop();
+    bool is_running();
+    t_line_record& get_record(unsigned);
+    void add(unsigned);
+    void finish();
+
+private:
+    struct t_band {
+        unsigned first;
+        unsigned last;
+    };
+
+    std::vector<std::thread> workers;
+    std::array<t_line_record, 240> records;
+
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    std::array<t_band, 240> bands;
+    unsigned bands_submitted;
+    unsigned bands_taken;
+    unsigned bands_pending;
+    bool stopping;
+
+    unsigned band_first;
+    unsigned band_end;
+
+    void submit();
+    void work();
+};
@@ -9,6 +9,10 @@
 
 const auto fps_update_interval_ms = 500u;
 
+// frames skipped in a row at most when skipping automatically, so something
+// is still shown when the emulation can not keep up at all
+const auto max_auto_frame_skip = 8u;
+
 const auto in_scr_width = 256u;
 const auto in_scr_height = 240u;
 
@@ -28,8 +32,6 @@ const int sdl::key_kp_7 = SDL_SCANCODE_KP_7;
 const int sdl::key_kp_8 = SDL_SCANCODE_KP_8;
 const int sdl::key_kp_9 = SDL_SCANCODE_KP_9;
 
-std::array<bool, 1024> keyboard_state;
-
 const char palette[][3] = {
     {0x75, 0x75, 0x75},
     {0x27, 0x1b, 0x8f},
@@ -97,45 +99,64 @@ const char palette[][3] = {
     {0x00, 0x00, 0x00}
 };
 
-namespace {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-
-    std::array<char, in_scr_width * in_scr_height> screen;
-    unsigned scr_idx;
-    long frame_idx;
-    t_millisecond_timer timer;
-    bool has_started;
-    bool running;
-    bool frame_done;
-    unsigned max_frames_per_second;
-    bool has_polled_after_rendering;
-    long fps_frame_count;
-    long fps_last_update;
-    long cur_fps;
+t_sdl_session::t_sdl_session() {
+    ready = SDL_Init(SDL_INIT_VIDEO) >= 0;
+    if (not ready) {
+        std::cerr << "sdl init fail : " << SDL_GetError() << "\n";
+    }
+}
+
+t_sdl_session::~t_sdl_session() {
+    if (ready) {
+        SDL_Quit();
+    }
+}
+
+bool t_sdl_session::is_ready() {
+    return ready;
+}
+
+t_display::t_display() :
+    window(nullptr),
+    renderer(nullptr),
+    texture(nullptr),
+    headless(false),
+    has_started(false),
+    running(false) {
 }
 
-void sdl::render() {
+// a deferred frame is drawn by the next call to present, so the thread
+// that owns the window does the drawing when the ppu runs on another one
+void t_display::render() {
+    if (deferred) {
+        present_pending = true;
+        return;
+    }
+    draw();
+}
+
+void t_display::present() {
+    if (present_pending) {
+        present_pending = false;
+        draw();
+    }
+}
+
+void t_display::draw() {
     if (not has_started) {
         return;
     }
 
-    SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
-    SDL_RenderClear(renderer);
-    for (auto i = overscan_top; i < in_scr_height - overscan_bot; i++) {
-        for (auto j = 0u; j < in_scr_width; j++) {
-            auto idx = i * in_scr_width + j;
-            auto rgb = &palette[screen[idx]][0];
-            SDL_SetRenderDrawColor(renderer, rgb[0], rgb[1], rgb[2], 0xff);
-            auto ih = in_scr_height - overscan_top - overscan_bot;
-            auto rx = int(out_scr_width * j / in_scr_width);
-            auto ry = int(out_scr_height * (i - overscan_top) / ih);
-            auto rw = int(out_scr_width / in_scr_width);
-            auto rh = int(out_scr_height / ih);
-            SDL_Rect rect = { rx, ry, rw, rh };
-            SDL_RenderFillRect(renderer, &rect);
-        }
+    if (headless) {
+        end_frame();
+        return;
     }
+
+    SDL_UpdateTexture(texture, nullptr, &screen[0],
+            int(in_scr_width * sizeof(screen[0])));
+    auto ih = int(in_scr_height - overscan_top - overscan_bot);
+    SDL_Rect src = { 0, int(overscan_top), int(in_scr_width), ih };
+    SDL_RenderCopy(renderer, texture, &src, nullptr);
     SDL_RenderPresent(renderer);
 
     if (timer.get_ticks() > fps_last_update + fps_update_interval_ms) {
@@ -149,28 +170,107 @@ void sdl::render() {
     std::snprintf(&buf[0], buf.size(), "%05ld fps %03ld", frame_idx, cur_fps);
     SDL_SetWindowTitle(window, &buf[0]);
 
+    end_frame();
+}
+
+// a frame counts for pacing whether it is shown or skipped, so skipping
+// does not change the speed at which the game runs
+void t_display::end_frame() {
     scr_idx = 0;
     frame_done = true;
     frame_idx++;
     has_polled_after_rendering = false;
 }
 
-void sdl::send_pixel(char color) {
+// decides whether the frame about to start is drawn, with a fixed skip the
+// given number of frames is skipped after each one drawn, the automatic one
+// skips while the frames are late for the frames per second asked for
+bool t_display::begin_frame() {
+    if (not has_started) {
+        return true;
+    }
+    auto skip = false;
+    if (auto_frame_skip) {
+        auto late = max_frames_per_second * timer.get_ticks()
+            > 1000 * (frame_idx + 1);
+        skip = late and skipped_in_row < max_auto_frame_skip;
+    } else {
+        skip = skipped_in_row < frame_skip;
+    }
+    skipped_in_row = skip ? skipped_in_row + 1 : 0;
+    return not skip;
+}
+
+void t_display::skip_frame() {
+    if (not has_started) {
+        return;
+    }
+    end_frame();
+}
+
+void t_display::send_pixel(uint32_t pixel) {
     if (not has_started) {
         return;
     }
     if (scr_idx < screen.size()) {
-        screen[scr_idx] = color;
+        screen[scr_idx] = pixel;
         scr_idx++;
     }
 }
 
-int sdl::init() {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        std::cerr << "sdl init fail : " << SDL_GetError() << "\n";
+// takes the place of the next line of pixels, for them to be written later
+uint32_t* t_display::reserve_line() {
+    if (not has_started or scr_idx + in_scr_width > screen.size()) {
+        return nullptr;
+    }
+    auto res = &screen[scr_idx];
+    scr_idx += in_scr_width;
+    return res;
+}
+
+// the pixel of the texture showing a color of the nes palette, the ppu
+// keeps the ones of its palette ram so frames are written as they are shown
+uint32_t t_display::get_pixel(char color) {
+    auto rgb = &palette[get_last_bits(color, 6)][0];
+    return 0xff000000u | uint32_t(rgb[0]) << 16 | uint32_t(rgb[1]) << 8
+        | uint32_t(rgb[2]);
+}
+
+// a headless display keeps the frames without showing them and reads no
+// keys, it has to be chosen before init
+void t_display::set_headless(bool val) {
+    headless = val;
+}
+
+int t_display::init() {
+    if (not headless and open_window() != success) {
         return failure;
     }
 
+    std::fill(screen.begin(), screen.end(), get_pixel(0x00));
+    scr_idx = 0;
+    frame_idx = 0;
+    frame_done = false;
+    running = true;
+    has_started = false;
+    max_frames_per_second = 60;
+    has_polled_after_rendering = false;
+    fps_frame_count = 0;
+    fps_last_update = 0;
+    cur_fps = 0;
+    frame_skip = 0;
+    auto_frame_skip = false;
+    skipped_in_row = 0;
+    deferred = false;
+    present_pending = false;
+
+    std::fill(keyboard_state.begin(), keyboard_state.end(), false);
+
+    return success;
+}
+
+// sdl itself is set up by the t_sdl_session of the process
+int t_display::open_window() {
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
 
     auto wu = SDL_WINDOWPOS_UNDEFINED;
@@ -192,24 +292,20 @@ int sdl::init() {
     SDL_RenderClear(renderer);
     SDL_RenderPresent(renderer);
 
-    std::fill(screen.begin(), screen.end(), 0x00);
-    scr_idx = 0;
-    frame_idx = 0;
-    frame_done = false;
-    running = true;
-    has_started = false;
-    max_frames_per_second = 60;
-    has_polled_after_rendering = false;
-    fps_frame_count = 0;
-    fps_last_update = 0;
-    cur_fps = 0;
-
-    std::fill(keyboard_state.begin(), keyboard_state.end(), false);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_STREAMING, in_scr_width, in_scr_height);
+    if (texture == nullptr) {
+        std::cerr << "sdl create texture fail : " << SDL_GetError() << "\n";
+        return failure;
+    }
 
     return success;
 }
 
-void sdl::poll() {
+void t_display::poll() {
+    if (headless) {
+        return;
+    }
     SDL_Event event;
     while (SDL_PollEvent(&event) != 0) {
         if (event.type == SDL_QUIT) {
@@ -225,11 +321,11 @@ void sdl::poll() {
     }
 }
 
-bool sdl::is_running() {
+bool t_display::is_running() {
     return running;
 }
 
-bool sdl::should_poll() {
+bool t_display::should_poll() {
     if (frame_done) {
         if (not has_polled_after_rendering) {
             has_polled_after_rendering = true;
@@ -245,24 +341,30 @@ bool sdl::should_poll() {
     return false;
 }
 
-void sdl::start() {
+void t_display::start() {
     if (not has_started) {
         has_started = true;
         timer.reset();
     }
 }
 
-void sdl::close() {
+void t_display::close() {
     running = false;
+    if (headless) {
+        return;
+    }
+    SDL_DestroyTexture(texture);
+    texture = nullptr;
     SDL_DestroyRenderer(renderer);
     renderer = nullptr;
     SDL_DestroyWindow(window);
     window = nullptr;
-
-    SDL_Quit();
 }
 
-bool sdl::get_key(int sc) {
+bool t_display::get_key(int sc) {
+    if (headless) {
+        return false;
+    }
     auto res = keyboard_state[sc];
 
     auto ks = SDL_GetKeyboardState(nullptr);
@@ -271,6 +373,16 @@ bool sdl::get_key(int sc) {
     return res;
 }
 
-void sdl::set_frames_per_second(unsigned val) {
+void t_display::set_frames_per_second(unsigned val) {
     max_frames_per_second = val;
 }
+
+void t_display::set_deferred(bool val) {
+    deferred = val;
+}
+
+void t_display::set_frame_skip(unsigned frames, bool automatic) {
+    frame_skip = frames;
+    auto_frame_skip = automatic;
+    skipped_in_row = 0;
+}
@@ -1,27 +1,98 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+
+#include "misc.hpp"
+
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+
 namespace sdl {
+    extern const int key_kp_1;
+    extern const int key_kp_2;
+    extern const int key_kp_3;
+    extern const int key_kp_4;
+    extern const int key_kp_5;
+    extern const int key_kp_6;
+    extern const int key_kp_7;
+    extern const int key_kp_8;
+    extern const int key_kp_9;
+}
+
+// sdl for the whole process, made once before the first display with a
+// window is initialized and kept until the last one is closed
+class t_sdl_session {
+public:
+    t_sdl_session();
+    ~t_sdl_session();
+    t_sdl_session(const t_sdl_session&) = delete;
+    t_sdl_session& operator=(const t_sdl_session&) = delete;
+
+    bool is_ready();
+
+private:
+    bool ready;
+};
+
+class t_display {
+public:
+    t_display();
+    t_display(const t_display&) = delete;
+    t_display& operator=(const t_display&) = delete;
+
+    void set_headless(bool);
     int init();
     bool is_running();
     bool should_poll();
     void render();
+    void present();
     void poll();
     void start();
-    void send_pixel(char);
+    void send_pixel(uint32_t);
+    uint32_t* reserve_line();
+    uint32_t get_pixel(char);
+    bool begin_frame();
+    void skip_frame();
     void set_frames_per_second(unsigned);
+    void set_frame_skip(unsigned, bool);
+    void set_deferred(bool);
     void close();
 
     void debug_render();
     void debug_send_pixel(char);
 
     bool get_key(int);
-    extern const int key_kp_1;
-    extern const int key_kp_2;
-    extern const int key_kp_3;
-    extern const int key_kp_4;
-    extern const int key_kp_5;
-    extern const int key_kp_6;
-    extern const int key_kp_7;
-    extern const int key_kp_8;
-    extern const int key_kp_9;
-}
+
+private:
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    bool headless;
+
+    // the frame in the pixel format of the texture
+    std::array<uint32_t, 256 * 240> screen;
+    unsigned scr_idx;
+    long frame_idx;
+    t_millisecond_timer timer;
+    bool has_started;
+    bool running;
+    bool frame_done;
+    unsigned max_frames_per_second;
+    bool has_polled_after_rendering;
+    long fps_frame_count;
+    long fps_last_update;
+    long cur_fps;
+    unsigned frame_skip;
+    bool auto_frame_skip;
+    unsigned skipped_in_row;
+    bool deferred;
+    bool present_pending;
+
+    std::array<bool, 1024> keyboard_state;
+
+    int open_window();
+    void draw();
+    void end_frame();
+};